@@ -0,0 +1,90 @@
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <atomic>
+#include <new> // for bad_alloc
+#include <stdexcept>
+#include <cstdint>
+#include <cstdlib> // for malloc, free
+
+#include "eepasm.h"
+#include "module_cache.h"
+
+// --count-allocs: the global operator new of eepasm counts heap allocations
+// while counting is on, which is only done by count_allocs
+
+namespace {
+
+std::atomic<bool> counting {false};
+std::atomic<long> allocs {0};
+
+// allocations per instruction allowed while encoding
+constexpr long alloc_budget = 0;
+
+long count_while(const auto& fn) {
+	allocs = 0;
+	counting = true;
+	fn();
+	counting = false;
+	return allocs;
+}
+
+}
+
+void *operator new(size_t size) {
+	if (counting.load(std::memory_order_relaxed))
+		allocs.fetch_add(1, std::memory_order_relaxed);
+	void *p = std::malloc(size ? size : 1);
+	if (!p)
+		throw std::bad_alloc {};
+	return p;
+}
+
+void operator delete(void *p) noexcept {
+	std::free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+	std::free(p);
+}
+
+// assemble infile on one thread to the ram format, discarding the output,
+// and count the allocations of both passes: the second one (matching,
+// encoding and formatting every instruction) must stay within alloc_budget
+bool count_allocs(const insmap_t& insmap, const std::string& infile_name, std::ostream& out) {
+	file_map src {infile_name};
+	if (!src.is_open())
+		throw assem_error {"can't open input file '" + infile_name + "'"};
+	std::pair<tokvec_t, symtab_t> pass1;
+	module_cache_t module_cache;
+	module_refs_t modules {module_cache};
+	std::string long_text;
+	long pass1_allocs = count_while([&]() {
+		pass1 = tokenize_file(src.view(), insmap, modules, infile_name);
+		relax(insmap, pass1.first, pass1.second, long_text);
+	});
+	const auto& [tok_vec, labels] = pass1;
+
+	out_writer outfile {"/dev/null", outfmt_t::ram};
+	long instructions = 0;
+	long pass2_allocs = count_while([&]() {
+		int pc = 0;
+		for (const auto& tokens : tok_vec) {
+			if (is_org(tokens)) {
+				pc = org_parse(tokens);
+				continue;
+			}
+			outfile.put(pc, encode_line(insmap, tokens, pc, labels));
+			pc++;
+			instructions++;
+		}
+	});
+	outfile.close();
+
+	out << "tokenize: " << pass1_allocs << " allocations for " << src.view().size() << " bytes\n"
+		<< "encode:   " << pass2_allocs << " allocations for " << instructions << " instructions (budget "
+		<< alloc_budget << " per instruction)\n";
+	return pass2_allocs <= alloc_budget * instructions;
+}
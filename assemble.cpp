@@ -0,0 +1,578 @@
+#include <iostream>
+#include <fstream>
+#include <unordered_map>
+#include <functional> // for function objects
+#include <vector>
+#include <utility> // for pair
+#include <algorithm> // for transform
+#include <stdexcept>
+#include <cstdint>
+#include <string>
+#include <sstream>
+#include <string_view>
+#include <cstring> // for memchr
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <exception> // for exception_ptr
+
+#include "eepasm.h"
+#include "module_cache.h"
+
+// indexed by optype_t
+uint16_t (*const optype_fns[num_optypes])(std::string_view, const operand_t&, int, const symtab_t&) {
+	reg_parse,
+	imm_parse,
+	label_parse,
+	lit_parse,
+};
+
+// fn(i) for i in [0, n) on up to nthreads threads, the calling one included
+void parallel_for(size_t n, unsigned nthreads, const std::function<void(size_t)>& fn) {
+	std::atomic<size_t> next {0};
+	auto worker = [&]() {
+		for (size_t i; (i = next++) < n;)
+			fn(i);
+	};
+	std::vector<std::thread> threads;
+	for (size_t t = 1; t < std::min<size_t>(nthreads, n); t++)
+		threads.emplace_back(worker);
+	worker();
+	for (auto& thread : threads)
+		thread.join();
+}
+
+// records per chunk of parallel encoding at least, smaller sources are
+// encoded serially
+constexpr size_t encode_chunk_min = 1 << 14;
+
+// records encoded by one thread: their words, or lines for the ram format,
+// up to the first error which is kept to be thrown in order
+struct encode_chunk_t {
+	size_t begin = 0;
+	size_t end = 0;
+	int pc = 0; // at begin
+	std::vector<uint16_t> words;
+	std::string text;
+	std::exception_ptr err;
+	asm_stats_t stats; // counters if stats are kept
+};
+
+// pass 2 on nthreads threads: the records are cut into chunks encoded into
+// their own buffers, which are written in order afterwards so the output and
+// the error thrown are the same as with the serial loop of assemble_file
+void encode_parallel(const insmap_t& insmap, const tokvec_t& tok_vec, const symtab_t& labels, out_writer& outfile, outfmt_t fmt, unsigned nthreads, asm_stats_t *stats) {
+	size_t nchunks = std::min<size_t>(nthreads * 4, tok_vec.size() / encode_chunk_min);
+	std::vector<encode_chunk_t> chunks(nchunks);
+	int pc = 0;
+	size_t idx = 0;
+	for (size_t c = 0; c < nchunks; c++) {
+		chunks[c].begin = idx;
+		chunks[c].pc = pc;
+		chunks[c].end = tok_vec.size() * (c + 1) / nchunks;
+		for (; idx < chunks[c].end; idx++)
+			pc = is_org(tok_vec[idx]) ? org_parse(tok_vec[idx]) : pc + 1;
+	}
+
+	bool ram = fmt == outfmt_t::ram;
+	auto encode_chunk = [&](encode_chunk_t& chunk) {
+		if (ram)
+			chunk.text.reserve((chunk.end - chunk.begin) * 16);
+		else
+			chunk.words.reserve(chunk.end - chunk.begin);
+		int pc = chunk.pc;
+		try {
+			for (size_t i = chunk.begin; i < chunk.end; i++) {
+				const tokline_t& tokens = tok_vec[i];
+				if (is_org(tokens)) {
+					pc = org_parse(tokens);
+					continue;
+				}
+				uint16_t iword = encode_line(insmap, tokens, pc, labels, nullptr, stats ? &chunk.stats : nullptr);
+				if (ram) {
+					char line[32];
+					char *out = put_ram_line(line, pc, iword);
+					*out++ = '\n';
+					chunk.text.append(line, out - line);
+				} else {
+					chunk.words.push_back(iword);
+				}
+				pc++;
+			}
+		} catch (...) {
+			chunk.err = std::current_exception();
+		}
+	};
+	parallel_for(nchunks, nthreads, [&](size_t c) { encode_chunk(chunks[c]); });
+
+	for (const auto& chunk : chunks) {
+		if (stats)
+			stats_add(*stats, chunk.stats);
+		if (ram) {
+			outfile.put_text(chunk.text);
+		} else {
+			// range errors of the image formats come up here as in the serial loop
+			int pc = chunk.pc;
+			size_t word = 0;
+			for (size_t i = chunk.begin; word < chunk.words.size(); i++) {
+				const tokline_t& tokens = tok_vec[i];
+				if (is_org(tokens)) {
+					pc = org_parse(tokens);
+					continue;
+				}
+				try {
+					outfile.put(pc, chunk.words[word++]);
+				} catch (const assem_error& err) {
+					throw source_error {tokens, err.what()};
+				}
+				pc++;
+			}
+		}
+		if (chunk.err)
+			std::rethrow_exception(chunk.err);
+	}
+}
+
+// assemble_file with the included files kept in modules
+void assemble_linked(const insmap_t& insmap, const std::string& infile_name, const std::string& outfile_name, const asm_opts_t& opts, module_refs_t& modules) {
+	file_map src {infile_name};
+	if (!src.is_open())
+		throw assem_error {"can't open input file '" + infile_name + "'"};
+
+	// clock is only read between phases and only with stats
+	asm_stats_t *stats = opts.stats;
+	auto phase_start = stats ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point {};
+	auto phase_end = [&]() {
+		auto now = std::chrono::steady_clock::now();
+		double secs = std::chrono::duration<double>(now - phase_start).count();
+		phase_start = now;
+		return secs;
+	};
+
+	auto [tok_vec, label_map] = tokenize_file(src.view(), insmap, modules, infile_name, opts.threads, stats);
+	// in objects labels of other sections are placed by the linker, so
+	// branches are only checked there
+	std::string long_text;
+	if (!opts.object)
+		relax(insmap, tok_vec, label_map, long_text, stats);
+	if (stats) {
+		stats->tokenize = phase_end();
+		stats->ir_bytes = tok_vec.size() * sizeof(tokline_t);
+	}
+
+	if (opts.object) {
+		object_t obj = object_build(insmap, tok_vec, label_map, infile_name, stats);
+		if (stats)
+			stats->encode = phase_end();
+		obj_save(obj, outfile_name);
+		if (stats)
+			stats->output = phase_end();
+		if (!opts.sym_file.empty())
+			symtab_save(label_map, opts.sym_file, opts.out_fd);
+		return;
+	}
+
+	out_writer outfile {outfile_name, opts.fmt, opts.out_fd};
+	if (stats)
+		outfile.time_writes();
+	if (opts.cache_dir != "") {
+		encode_cached(insmap, tok_vec, label_map, outfile, infile_name, opts);
+	} else if (opts.threads > 1 && tok_vec.size() >= 2 * encode_chunk_min) {
+		encode_parallel(insmap, tok_vec, label_map, outfile, opts.fmt, opts.threads, stats);
+	} else {
+		int pc = 0;
+		for (const auto& tokens : tok_vec) {
+			if (is_org(tokens)) {
+				pc = org_parse(tokens);
+				continue;
+			}
+			uint16_t iword = encode_line(insmap, tokens, pc, label_map, nullptr, stats);
+			try {
+				outfile.put(pc, iword);
+			} catch (const assem_error& err) {
+				throw source_error {tokens, err.what()};
+			}
+			pc++;
+		}
+	}
+	if (stats) {
+		// buffer flushes while encoding count as output
+		stats->encode = phase_end() - outfile.write_time();
+		stats->output = outfile.write_time();
+	}
+	outfile.close();
+
+	if (stats) {
+		stats->output += phase_end();
+		stats->bytes_written = outfile.bytes_written();
+	}
+	if (!opts.sym_file.empty())
+		symtab_save(label_map, opts.sym_file, opts.out_fd);
+}
+
+// assemble one source file: throws assem_error with the complete message
+// instead of exiting so it can be used for every job of a batch
+void assemble_file(const insmap_t& insmap, const std::string& infile_name, const std::string& outfile_name, const asm_opts_t& opts) {
+	module_cache_t own_modules; // without a cache shared with other jobs
+	module_refs_t modules {opts.modules ? *opts.modules : own_modules};
+	try {
+		assemble_linked(insmap, infile_name, outfile_name, opts, modules);
+	} catch (const source_error& err) {
+		throw modules.locate(err);
+	}
+}
+
+// object of the tokens and labels of source: label operands are resolved
+// here if they refer to a label of the same kind of section (relocatable or
+// fixed) since their offset doesn't depend on where the linker puts the
+// relocatable section, all others become relocations
+object_t object_build(const insmap_t& insmap, const tokvec_t& tok_vec, const symtab_t& labels, const std::string& source, asm_stats_t *stats) {
+	object_t obj;
+	obj.source = source;
+	obj.sections.emplace_back();
+
+	// every defined label is exported
+	std::unordered_map<std::string_view, int, ci_hash, ci_equal> sym_index;
+	for (const auto& sym : labels.syms) {
+		if (sym.value < 0)
+			continue;
+		sym_index[sym.name] = obj.symbols.size();
+		obj.symbols.push_back({std::string {sym.name}, sym.absolute ? sym_abs : 0, sym.value, sym.line});
+	}
+
+	const symtab_t no_labels;
+	std::vector<unresolved_t> unresolved;
+	int section = 0;
+	int pc = 0;
+	for (const auto& line_tokens : tok_vec) {
+		if (is_org(line_tokens)) {
+			pc = org_parse(line_tokens);
+			section = obj.sections.size();
+			obj.sections.push_back({true, pc, {}});
+			continue;
+		}
+		// all label operands come back unresolved
+		tokline_t tokens = line_tokens;
+		tokens.label_op = -1;
+		unresolved.clear();
+		uint16_t iword = encode_line(insmap, tokens, pc, no_labels, &unresolved, stats);
+		std::vector<uint16_t>& words = obj.sections[section].words;
+		for (const auto& ref : unresolved) {
+			auto sym_it = sym_index.find(ref.label);
+			if (sym_it != sym_index.end() && (obj.symbols[sym_it->second].section == sym_abs) == (section > 0)) {
+				try {
+					iword += label_encode(ref.label, obj.symbols[sym_it->second].value, pc);
+				} catch (const assem_error& err) {
+					throw source_error {tokens, err.what()};
+				}
+				continue;
+			}
+			if (sym_it == sym_index.end()) {
+				sym_it = sym_index.emplace(ref.label, obj.symbols.size()).first;
+				obj.symbols.push_back({std::string {ref.label}, sym_undef, 0, 0});
+			}
+			obj.relocs.push_back({section, static_cast<int>(words.size()), sym_it->second, 0, offset_size});
+		}
+		words.push_back(iword);
+		pc++;
+	}
+	if (obj.sections[0].words.size() > 1 << 16)
+		throw assem_error {"relocatable section of " + std::to_string(obj.sections[0].words.size()) + " words doesn't fit into memory"};
+	return obj;
+}
+
+// encode the instruction in tokens at address pc. Label operands missing in
+// labels are an error unless unresolved is given: then they are appended to
+// it and their field is left 0 to be patched later. With stats the
+// lookups done are counted.
+uint16_t encode_line(const insmap_t& insmap, const tokline_t& tokens, int pc, const symtab_t& labels, std::vector<unresolved_t> *unresolved, asm_stats_t *stats) {
+	try {
+		const insdef_t *ins_def = tokens.ins ? tokens.ins : insmap.lookup(tokens.tok(0), stats);
+		if (!ins_def)
+			throw assem_error {"unknown instruction"};
+		const insdef_t& ins = *ins_def;
+
+		match_t match = ins_match(ins, tokens);
+		if (stats)
+			stats->alts_tried++;
+		if (match.alt < 0)
+			throw assem_error {"no matching version of instruction found"};
+
+		const oplist_t& alt = ins.alts[match.alt];
+		if (stats) {
+			stats->instructions++;
+			stats->shorthand += match.dup;
+			// label operands not interned by tokenize_file are looked up by name
+			for (int alt_op = 0; alt_op < alt.size(); alt_op++) {
+				int tok_op = (match.dup && alt_op > 0) ? alt_op - 1 : alt_op;
+				stats->map_lookups += alt[alt_op].type == optype_t::label && tok_op != tokens.label_op;
+			}
+		}
+		if (!ins.encoders.empty())
+			return ins.encoders[match.alt](alt, tokens, match.dup, pc, labels, unresolved);
+		uint16_t iword = ins.const_iword;
+		for (int alt_op = 0; alt_op < alt.size(); alt_op++) {
+			// with the 2 operand shorthand the first operand is used twice
+			int tok_op = (match.dup && alt_op > 0) ? alt_op - 1 : alt_op;
+			std::string_view op = tokens.op(tok_op);
+			if (alt[alt_op].type == optype_t::label) {
+				int value = label_value(tokens, tok_op, labels);
+				if (value < 0 && unresolved)
+					unresolved->push_back({op, &alt[alt_op]});
+				else
+					iword += label_encode(op, value, pc);
+				continue;
+			}
+			iword += optype_fns[static_cast<int>(alt[alt_op].type)](op, alt[alt_op], pc, labels);
+		}
+		return iword;
+	} catch (const assem_error& err) {
+		throw source_error {tokens, err.what()};
+	} catch (const std::logic_error& err) {
+		throw source_error {tokens, "invalid number"};
+	}
+}
+
+// error message pointing at the source line of tokens; the file of a line
+// of an included file is added by module_refs_t::locate
+std::string line_error(const tokline_t& tokens, const std::string& msg) {
+	return "line " + std::to_string(tokens.line) + ":" + std::to_string(tokens.col(0))
+		+ " (" + std::string {tokens.tok(0)} + "): " + msg;
+}
+
+source_error::source_error(const tokline_t& tokens, const std::string& msg)
+	: assem_error {line_error(tokens, msg)}, line {tokens.line}, col {tokens.col(0)},
+	token {tokens.tok(0)}, msg {msg}, text {tokens.text} {}
+
+source_error::source_error(const source_error& err, const std::string& file)
+	: assem_error {file + ": " + err.what()}, line {err.line}, col {err.col},
+	token {err.token}, msg {err.msg}, file {file}, text {err.text} {}
+
+bool is_org(const tokline_t& tokens) {
+	return ci_eq(tokens.tok(0), "org");
+}
+
+// address of an org line
+int org_parse(const tokline_t& tokens) {
+	try {
+		if (tokens.nops() < 1)
+			throw assem_error {"missing address"};
+		return num_parse(tokens.op(0));
+	} catch (const std::logic_error& err) {
+		throw source_error {tokens, "invalid address"};
+	} catch (const assem_error& err) {
+		throw source_error {tokens, err.what()};
+	}
+}
+
+// operand of tokens which tokenize_file interns as a label: the first one
+// that is neither a register, an immediate nor a lit name of the
+// instruction, -1 if there is none
+int label_operand(const tokline_t& tokens) {
+	int nops = std::min(tokens.nops(), max_line_toks - 1);
+	for (int i = 0; i < nops; i++) {
+		std::string_view op = tokens.op(i);
+		if (reg_check(op) || imm_check(op))
+			continue;
+		if (lit_idx(*tokens.ins, op) == 0)
+			return i;
+	}
+	return -1;
+}
+
+// label at the start of the line (empty if there is none): every first
+// token that is neither an instruction nor org; it is removed from tokens.
+// The definition of the instruction is kept in tokens for encode_line.
+std::string_view strip_label(tokline_t& tokens, const insmap_t& insmap, asm_stats_t *stats) {
+	if (is_org(tokens) || is_include(tokens))
+		return {};
+	std::string_view first = tokens.tok(0);
+	tokens.ins = insmap.lookup(first, stats);
+	if (tokens.ins)
+		return {};
+	std::copy(tokens.tokens + 1, tokens.tokens + max_line_toks, tokens.tokens);
+	tokens.ntok--;
+	if (tokens.ntok > 0 && !is_org(tokens) && !is_include(tokens))
+		tokens.ins = insmap.lookup(tokens.tok(0), stats);
+	return first;
+}
+
+// lex src into out: tokens are views into src, labels are defined at the
+// index of the record they precede (see module_t). Lines are numbered from
+// 1, region_start is the state before the first line and is left as after
+// the last one. Returns the number of lines; lines, tokens, labels and
+// lookups are counted in stats if given.
+int lex_lines(std::string_view src, const insmap_t& insmap, module_t& out, bool& region_start, asm_stats_t *stats) {
+	int line_no = 0;
+	size_t pos = 0;
+	while (pos < src.size()) {
+		const char *eol = static_cast<const char *>(std::memchr(src.data() + pos, '\n', src.size() - pos));
+		size_t line_end = eol ? eol - src.data() : src.size();
+		tokline_t tokens = scan_line(src.substr(pos, line_end - pos), ++line_no);
+		pos = line_end + 1;
+		if (tokens.ntok == 0)
+			continue;
+		if (stats)
+			stats->tokens += tokens.ntok;
+
+		std::string_view label = strip_label(tokens, insmap, stats);
+		if (!label.empty()) {
+			try {
+				out.defs.push_back(out.labels.define(label, out.tok_vec.size(), line_no));
+			} catch (const assem_error& err) {
+				throw source_error {line_no, err.what()};
+			}
+			if (stats) {
+				stats->labels++;
+				stats->map_lookups++;
+			}
+			region_start = true;
+		}
+		if (tokens.ntok == 0) // if label on separate line
+			continue;
+
+		if (is_org(tokens)) {
+			org_parse(tokens); // only checked here
+			region_start = true;
+		} else if (is_include(tokens)) {
+			out.has_include = true;
+		} else if (tokens.ins && (tokens.label_op = label_operand(tokens)) >= 0) {
+			tokens.label_sym = out.labels.intern(tokens.op(tokens.label_op));
+			if (stats)
+				stats->map_lookups++;
+		}
+		tokens.region_start = region_start;
+		region_start = false;
+		out.tok_vec.push_back(tokens);
+	}
+	if (stats)
+		stats->lines += line_no;
+	return line_no;
+}
+
+void file_lex(std::string_view src, const insmap_t& insmap, module_t& out, asm_stats_t *stats) {
+	bool region_start = true;
+	lex_lines(src, insmap, out, region_start, stats);
+}
+
+// bytes of source per chunk of parallel lexing at least, smaller sources
+// are lexed serially
+constexpr size_t lex_chunk_min = 1 << 18;
+
+// part of a source cut at line boundaries, lexed on its own: lines,
+// records and label values are relative to the chunk
+struct lex_chunk_t {
+	std::string_view src;
+	module_t mod;
+	int lines = 0;
+	bool region_start = false; // pending after the last line
+	bool failed = false;
+	size_t line_off = 0; // of the chunk in the source, by prefix sums
+	size_t rec_off = 0;
+	std::vector<int> remap; // chunk symbol id to id in the source
+	asm_stats_t stats; // counters if stats are kept
+};
+
+// file_lex on nthreads threads: every chunk is lexed with its own symbol
+// table, then prefix sums of the line and record counts give the offsets
+// turning chunk-relative line numbers, label values and symbol ids into
+// those of the whole source. Symbols are merged in chunk order, so they get
+// the ids of a serial lex. Any error lexes the source again serially to
+// report it exactly like file_lex; false if it is too small to be split.
+bool file_lex_parallel(std::string_view src, const insmap_t& insmap, module_t& out, unsigned nthreads, asm_stats_t *stats) {
+	size_t nchunks = std::min<size_t>(nthreads * 4, src.size() / lex_chunk_min);
+	if (nthreads < 2 || nchunks < 2)
+		return false;
+	std::vector<lex_chunk_t> chunks(nchunks);
+	size_t begin = 0;
+	for (size_t c = 0; c < nchunks; c++) {
+		size_t end = std::max(begin, src.size() * (c + 1) / nchunks);
+		const char *eol = static_cast<const char *>(std::memchr(src.data() + end, '\n', src.size() - end));
+		end = eol ? eol - src.data() + 1 : src.size();
+		chunks[c].src = src.substr(begin, end - begin);
+		begin = end;
+	}
+
+	parallel_for(nchunks, nthreads, [&](size_t c) {
+		lex_chunk_t& chunk = chunks[c];
+		try {
+			chunk.lines = lex_lines(chunk.src, insmap, chunk.mod, chunk.region_start, stats ? &chunk.stats : nullptr);
+		} catch (...) {
+			chunk.failed = true;
+		}
+	});
+
+	auto lex_serial = [&]() {
+		out = module_t {};
+		file_lex(src, insmap, out, stats);
+		return true;
+	};
+	if (std::any_of(chunks.begin(), chunks.end(), [](const lex_chunk_t& chunk) { return chunk.failed; }))
+		return lex_serial();
+
+	bool region_start = true;
+	size_t line_off = 0;
+	size_t rec_off = 0;
+	try {
+		for (auto& chunk : chunks) {
+			chunk.line_off = line_off;
+			chunk.rec_off = rec_off;
+			line_off += chunk.lines;
+			rec_off += chunk.mod.tok_vec.size();
+			for (const auto& sym : chunk.mod.labels.syms)
+				chunk.remap.push_back(out.labels.intern(sym.name));
+			for (int id : chunk.mod.defs) {
+				const symbol_t& sym = chunk.mod.labels.syms[id];
+				out.defs.push_back(out.labels.define(sym.name, sym.value + chunk.rec_off, sym.line + chunk.line_off));
+			}
+			out.has_include |= chunk.mod.has_include;
+			// a label or org at the end of one chunk starts the region of the next record
+			if (!chunk.mod.tok_vec.empty()) {
+				chunk.mod.tok_vec[0].region_start |= region_start;
+				region_start = false;
+			}
+			region_start |= chunk.region_start;
+		}
+	} catch (const assem_error&) { // label defined twice
+		return lex_serial();
+	}
+	if (stats) {
+		for (const auto& chunk : chunks) {
+			stats_add(*stats, chunk.stats);
+			stats->map_lookups += chunk.remap.size() + chunk.mod.defs.size(); // merged
+		}
+	}
+
+	out.tok_vec.resize(rec_off);
+	parallel_for(nchunks, nthreads, [&](size_t c) {
+		const lex_chunk_t& chunk = chunks[c];
+		tokline_t *dest = out.tok_vec.data() + chunk.rec_off;
+		for (tokline_t tokens : chunk.mod.tok_vec) {
+			tokens.line += chunk.line_off;
+			if (tokens.label_op >= 0)
+				tokens.label_sym = chunk.remap[tokens.label_sym];
+			*dest++ = tokens;
+		}
+	});
+	return true;
+}
+
+// tokens of src (usually memory-mapped) are views into src, so src has to
+// outlive the returned token vector and symbol table. Labels are interned
+// as they are defined or used, the symbol id of the label operand is kept
+// in its tokens. Included files are taken from modules and resolved
+// relative to the directory of src_path, modules keeps them alive. Large sources are lexed
+// on nthreads threads. Lexing and linking are counted in stats if given.
+std::pair<tokvec_t, symtab_t> tokenize_file(std::string_view src, const insmap_t& insmap, module_refs_t& modules, const std::string& src_path, unsigned nthreads, asm_stats_t *stats) {
+	module_t main;
+	if (!file_lex_parallel(src, insmap, main, nthreads, stats))
+		file_lex(src, insmap, main, stats);
+
+	link_state_t ln;
+	ln.stats = stats;
+	ln.modules = &modules;
+	ln.labels = std::move(main.labels);
+	ln.out.reserve(main.tok_vec.size());
+	module_link(main, src_path, true, insmap, ln);
+	return {std::move(ln.out), std::move(ln.labels)};
+}
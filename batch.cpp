@@ -0,0 +1,95 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <filesystem> // for lexically_normal
+#include <utility> // for pair
+#include <stdexcept>
+#include <string_view>
+#include <cstdint>
+
+#include "eepasm.h"
+#include "module_cache.h"
+#include "thread_pool.h"
+
+// output file of a batch job without explicit output name
+std::string batch_outfile(const std::string& infile_name, const std::string& outdir, const std::string& ext) {
+	std::string outfile_name = replace_ext(infile_name, ext);
+	if (outdir == "")
+		return outfile_name;
+	size_t slash = outfile_name.rfind('/');
+	if (slash != std::string::npos)
+		outfile_name = outfile_name.substr(slash + 1);
+	return outdir + "/" + outfile_name;
+}
+
+// (input, output) file pairs from command line arguments: either source files
+// or @manifest files with one "infile [outfile]" per line; every output
+// file once
+std::vector<std::pair<std::string, std::string>> batch_jobs(const std::vector<std::string>& args, const std::string& outdir, const std::string& ext) {
+	std::vector<std::pair<std::string, std::string>> jobs;
+	for (const auto& arg : args) {
+		if (arg[0] != '@') {
+			jobs.push_back({arg, batch_outfile(arg, outdir, ext)});
+			continue;
+		}
+
+		std::ifstream manifest {arg.substr(1)};
+		if (!manifest.is_open())
+			error("can't open manifest file '" + arg.substr(1) + "'");
+		std::string line, infile_name, outfile_name;
+		while (getline(manifest, line)) {
+			line_strip(line);
+			if (line == "")
+				continue;
+			std::istringstream line_stream {line};
+			line_stream >> infile_name;
+			if (!(line_stream >> outfile_name))
+				outfile_name = batch_outfile(infile_name, outdir, ext);
+			jobs.push_back({infile_name, outfile_name});
+		}
+	}
+
+	// jobs run at the same time: two of them must not write one file
+	std::unordered_set<std::string> outfiles;
+	for (const auto& job : jobs)
+		if (!outfiles.insert(std::filesystem::path(job.second).lexically_normal().string()).second)
+			error("output file '" + job.second + "' of '" + job.first + "' is written by another job too");
+	return jobs;
+}
+
+// assemble all jobs in parallel sharing one read-only insmap and its
+// included files; errors are reported in job order once all jobs are done
+bool batch_assemble(const insmap_t& insmap, const std::vector<std::pair<std::string, std::string>>& jobs, unsigned nthreads, const asm_opts_t& batch_opts) {
+	std::vector<std::string> errors(jobs.size());
+	module_cache_t modules;
+	asm_opts_t opts = batch_opts;
+	opts.modules = &modules;
+	{
+		thread_pool pool {nthreads};
+		for (size_t i = 0; i < jobs.size(); i++) {
+			pool.submit([&insmap, &jobs, &errors, &opts, i] {
+				try {
+					assemble_file(insmap, jobs[i].first, jobs[i].second, opts);
+				} catch (const assem_error& err) {
+					errors[i] = err.what();
+				} catch (const std::exception& err) {
+					errors[i] = err.what();
+				}
+			});
+		}
+		pool.wait();
+	}
+
+	bool ok = true;
+	for (size_t i = 0; i < jobs.size(); i++) {
+		if (errors[i] != "") {
+			std::cerr << "Error: " << jobs[i].first << ": " << errors[i] << std::endl;
+			ok = false;
+		}
+	}
+	return ok;
+}
@@ -0,0 +1,334 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <utility> // for pair
+#include <algorithm> // for sort, lower_bound, min
+#include <random>
+#include <chrono>
+#include <stdexcept>
+#include <cstdint>
+#include <cstdio> // for remove
+
+#include "eepasm.h"
+#include "module_cache.h"
+
+// Synthetic program generator and timing harness for the assembler phases
+
+constexpr long def_sizes[] = {1000, 10000, 100000, 1000000, 10000000};
+constexpr int label_window = 4; // labels referenced at most this many labels away
+
+struct gen_opts_t {
+	double label_density = 0.1; // fraction of lines with a label
+	double org_rate = 0.001; // fraction of lines preceded by an org
+	double shorthand = 0.3; // fraction of 3 operand lines written as 2 operands if possible
+	double comments = 0; // fraction of lines with a trailing comment, as many comment lines
+	int indent = 0; // most blanks around the tokens, 0: one tab before the mnemonic only
+	std::vector<std::pair<std::string, double>> mix; // mnemonic weights, empty: all 1
+	uint64_t seed = 1;
+};
+
+void usage() {
+	error("Usage: eepbench [-c configfile] [-r repeats] [-s sizes] [--csv] [generator options]\n"
+		"       eepbench --gen lines [-c configfile] [generator options]\n"
+		"generator options: --labels fraction  --org fraction  --shorthand fraction\n"
+		"                   --comments fraction  --indent n  --mix mnemonic=weight,...  --seed n\n"
+		"sizes: comma separated line counts (default: 1000,10000,100000,1000000,10000000)");
+}
+
+std::vector<std::pair<std::string, double>> mix_parse(const std::string& arg) {
+	std::vector<std::pair<std::string, double>> out;
+	size_t pos = 0;
+	while (pos < arg.size()) {
+		size_t end = arg.find(',', pos);
+		std::string item = arg.substr(pos, end - pos);
+		size_t eq = item.find('=');
+		if (eq == std::string::npos)
+			error("invalid mix entry '" + item + "'");
+		out.push_back({item.substr(0, eq), std::stod(item.substr(eq + 1))});
+		pos = end == std::string::npos ? arg.size() : end + 1;
+	}
+	return out;
+}
+
+std::string label_name(size_t idx) {
+	return "L" + std::to_string(idx);
+}
+
+// 1 to most spaces and tabs
+std::string blanks_gen(std::mt19937_64& rng, int most) {
+	std::string out(1 + rng() % most, ' ');
+	for (char& c : out)
+		if (rng() % 4 == 0)
+			c = '\t';
+	return out;
+}
+
+// "//" and up to 80 characters, delimiters and lone slashes included, so
+// comments end anywhere in the scanners' blocks
+std::string comment_gen(std::mt19937_64& rng) {
+	static constexpr std::string_view chars = "abcxyz019 \t,/;:()r1LDR";
+	std::string out = "//";
+	for (size_t n = rng() % 81; n > 0; n--)
+		out += chars[rng() % chars.size()];
+	return out;
+}
+
+std::string operand_gen(const operand_t& opd, std::mt19937_64& rng, const std::vector<long>& labels, long line) {
+	switch (opd.type) {
+	case optype_t::reg:
+		return "R" + std::to_string(rng() % 8);
+	case optype_t::imm: {
+		long val = rng() % (opd.mask + 1);
+		if (opd.size > 4)
+			val -= (opd.mask + 1) / 2; // signed field
+		return "#" + std::to_string(val);
+	}
+	case optype_t::label: {
+		// a label close to the line, before or after it
+		long near = std::lower_bound(labels.begin(), labels.end(), line) - labels.begin();
+		near += static_cast<long>(rng() % (2 * label_window + 1)) - label_window;
+		near = std::clamp(near, 0L, static_cast<long>(labels.size()) - 1);
+		return label_name(near);
+	}
+	case optype_t::lit:
+		return opd.name;
+	}
+	return "";
+}
+
+// program with the given number of instruction lines; every line is
+// checked to select an alternative of its instruction
+std::string gen_program(const insmap_t& insmap, long lines, const gen_opts_t& opts) {
+	std::mt19937_64 rng {opts.seed};
+	std::uniform_real_distribution<double> unit {0, 1};
+
+	std::vector<const std::pair<const std::string, insdef_t> *> mnemonics;
+	std::vector<double> weights;
+	for (const auto& entry : insmap) {
+		double weight = opts.mix.empty() ? 1 : 0;
+		for (const auto& [name, w] : opts.mix)
+			if (ci_eq(name, entry.first))
+				weight = w;
+		if (weight > 0) {
+			mnemonics.push_back(&entry);
+			weights.push_back(weight);
+		}
+	}
+	if (mnemonics.empty())
+		error("no instructions to generate");
+	// same program for the same seed regardless of hash map order
+	std::vector<size_t> order(mnemonics.size());
+	for (size_t i = 0; i < order.size(); i++)
+		order[i] = i;
+	std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return mnemonics[a]->second.index < mnemonics[b]->second.index; });
+	std::vector<double> sorted_weights;
+	for (size_t i : order)
+		sorted_weights.push_back(weights[i]);
+	std::discrete_distribution<size_t> pick {sorted_weights.begin(), sorted_weights.end()};
+
+	std::vector<long> labels; // line of every label
+	for (long i = 0; i < lines; i++)
+		if (unit(rng) < opts.label_density)
+			labels.push_back(i);
+
+	std::string out;
+	size_t next_label = 0;
+	long pc = 0;
+	for (long i = 0; i < lines; i++) {
+		if (unit(rng) < opts.org_rate) {
+			pc += 1 + rng() % 256;
+			out += "org " + std::to_string(pc) + "\n";
+		}
+		if (opts.comments > 0 && unit(rng) < opts.comments) {
+			if (opts.indent > 0 && rng() % 2)
+				out += blanks_gen(rng, opts.indent);
+			out += comment_gen(rng) + "\n";
+		}
+		if (next_label < labels.size() && labels[next_label] == i)
+			out += label_name(next_label++);
+
+		std::string line;
+		for (int tries = 0; line.empty(); tries++) {
+			if (tries == 100)
+				error("can't generate a valid line for the instruction mix");
+			const auto& [name, ins] = *mnemonics[order[pick(rng)]];
+			const oplist_t& alt = ins.alts[rng() % ins.alts.size()];
+			bool need_label = std::any_of(alt.begin(), alt.end(), [](const operand_t& opd) { return opd.type == optype_t::label; });
+			if (need_label && labels.empty())
+				continue;
+
+			std::vector<std::string> ops;
+			for (const auto& opd : alt)
+				ops.push_back(operand_gen(opd, rng, labels, i));
+			if (ops.size() == 3 && alt[0].type == optype_t::reg && alt[1].type == optype_t::reg && unit(rng) < opts.shorthand) {
+				ops[1] = ops[0];
+				ops.erase(ops.begin());
+			}
+			std::string cand = "\t" + name;
+			if (opts.indent > 0) {
+				cand = blanks_gen(rng, opts.indent) + name;
+				for (size_t op = 0; op < ops.size(); op++) {
+					if (op > 0)
+						cand += (rng() % 2 ? "" : blanks_gen(rng, opts.indent)) + ",";
+					cand += blanks_gen(rng, opts.indent) + ops[op];
+				}
+			} else {
+				for (size_t op = 0; op < ops.size(); op++)
+					cand += (op == 0 ? " " : ", ") + ops[op];
+			}
+			if (opts.comments > 0 && unit(rng) < opts.comments) {
+				cand += opts.indent > 0 ? blanks_gen(rng, opts.indent) : " ";
+				cand += comment_gen(rng);
+			}
+			if (ins_match(ins, scan_line(cand, 1)).alt >= 0)
+				line = cand;
+		}
+		out += line + "\n";
+		pc++;
+	}
+	return out;
+}
+
+struct bench_result_t {
+	long lines;
+	size_t bytes;
+	double insmap_gen, tokenize, encode, output;
+};
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// best of repeats for every phase
+bench_result_t bench_run(const std::string& conf_file, const std::string& src, long lines, int repeats) {
+	bench_result_t res {lines, src.size(), 1e30, 1e30, 1e30, 1e30};
+	std::string out_file = "/tmp/eepbench." + std::to_string(lines) + ".ram";
+	for (int r = 0; r < repeats; r++) {
+		auto start = std::chrono::steady_clock::now();
+		insmap_t insmap = insmap_gen(conf_file);
+		res.insmap_gen = std::min(res.insmap_gen, seconds_since(start));
+
+		start = std::chrono::steady_clock::now();
+		module_cache_t module_cache;
+		module_refs_t modules {module_cache};
+		auto [tok_vec, label_map] = tokenize_file(src, insmap, modules);
+		std::string long_text;
+		relax(insmap, tok_vec, label_map, long_text);
+		res.tokenize = std::min(res.tokenize, seconds_since(start));
+
+		start = std::chrono::steady_clock::now();
+		std::vector<std::pair<int, uint16_t>> words;
+		words.reserve(tok_vec.size());
+		int pc = 0;
+		for (const auto& tokens : tok_vec) {
+			if (is_org(tokens)) {
+				pc = org_parse(tokens);
+				continue;
+			}
+			words.push_back({pc, encode_line(insmap, tokens, pc, label_map)});
+			pc++;
+		}
+		res.encode = std::min(res.encode, seconds_since(start));
+
+		start = std::chrono::steady_clock::now();
+		out_writer outfile {out_file, outfmt_t::ram};
+		for (const auto& [word_pc, iword] : words)
+			outfile.put(word_pc, iword);
+		outfile.close();
+		res.output = std::min(res.output, seconds_since(start));
+	}
+	std::remove(out_file.c_str());
+	return res;
+}
+
+void result_print(const bench_result_t& res, bool csv, bool first) {
+	double asm_time = res.tokenize + res.encode + res.output;
+	if (csv) {
+		if (first)
+			std::cout << "lines,bytes,insmap_gen_s,tokenize_s,encode_s,output_s,total_s,lines_per_s,bytes_per_s\n";
+		std::cout << res.lines << "," << res.bytes << "," << res.insmap_gen << "," << res.tokenize << ","
+			<< res.encode << "," << res.output << "," << asm_time << "," << res.lines / asm_time << ","
+			<< res.bytes / asm_time << "\n";
+		return;
+	}
+	std::cout << (first ? "[\n" : ",\n") << "  {\"lines\": " << res.lines << ", \"bytes\": " << res.bytes
+		<< ", \"insmap_gen_s\": " << res.insmap_gen << ", \"tokenize_s\": " << res.tokenize
+		<< ", \"encode_s\": " << res.encode << ", \"output_s\": " << res.output
+		<< ", \"total_s\": " << asm_time << ", \"lines_per_s\": " << res.lines / asm_time
+		<< ", \"bytes_per_s\": " << res.bytes / asm_time << "}";
+}
+
+int main(int argc, char *argv[]) {
+	std::string insfile = def_insfile;
+	std::vector<long> sizes {std::begin(def_sizes), std::end(def_sizes)};
+	gen_opts_t gen_opts;
+	long gen_lines = 0;
+	int repeats = 3;
+	bool csv = false;
+
+	try {
+		for (int i = 1; i < argc; i++) {
+			std::string arg = argv[i];
+			if (arg == "--csv") {
+				csv = true;
+			} else if (i + 1 >= argc) {
+				usage();
+			} else if (arg == "-c") {
+				insfile = argv[++i];
+			} else if (arg == "-r") {
+				repeats = std::max(1, std::stoi(argv[++i]));
+			} else if (arg == "-s") {
+				sizes.clear();
+				std::string list = argv[++i];
+				for (size_t pos = 0; pos < list.size();) {
+					size_t end = list.find(',', pos);
+					sizes.push_back(std::stol(list.substr(pos, end - pos)));
+					pos = end == std::string::npos ? list.size() : end + 1;
+				}
+			} else if (arg == "--gen") {
+				gen_lines = std::stol(argv[++i]);
+			} else if (arg == "--labels") {
+				gen_opts.label_density = std::stod(argv[++i]);
+			} else if (arg == "--org") {
+				gen_opts.org_rate = std::stod(argv[++i]);
+			} else if (arg == "--shorthand") {
+				gen_opts.shorthand = std::stod(argv[++i]);
+			} else if (arg == "--comments") {
+				gen_opts.comments = std::stod(argv[++i]);
+			} else if (arg == "--indent") {
+				gen_opts.indent = std::max(0, std::stoi(argv[++i]));
+			} else if (arg == "--mix") {
+				gen_opts.mix = mix_parse(argv[++i]);
+			} else if (arg == "--seed") {
+				gen_opts.seed = std::stoull(argv[++i]);
+			} else {
+				std::cerr << "Unrecognized option " << arg << std::endl;
+				usage();
+			}
+		}
+	} catch (const std::logic_error& err) {
+		usage();
+	}
+
+	if (sizes.empty())
+		usage();
+
+	insmap_t insmap = insmap_gen(insfile);
+	if (gen_lines > 0) {
+		std::string src = gen_program(insmap, gen_lines, gen_opts);
+		std::cout.write(src.data(), src.size());
+		return 0;
+	}
+
+	for (size_t i = 0; i < sizes.size(); i++) {
+		std::string src = gen_program(insmap, sizes[i], gen_opts);
+		result_print(bench_run(insfile, src, sizes[i], repeats), csv, i == 0);
+		std::cout.flush();
+	}
+	if (!csv)
+		std::cout << "\n]\n";
+	return 0;
+}
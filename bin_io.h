@@ -0,0 +1,55 @@
+#ifndef BIN_IO_H
+#define BIN_IO_H
+
+#include <cstring>
+#include <string>
+
+#include "eepasm.h"
+
+// helpers for the binary cache files (host byte order)
+
+// bounds checked reader over a (memory-mapped) binary file
+class bin_reader {
+public:
+	bin_reader(const char *data, size_t len) : pos {data}, end {data + len} {}
+
+	template <typename T>
+	T get() {
+		T val;
+		if (end - pos < static_cast<long>(sizeof(T)))
+			throw parsing_error {"truncated binary file"};
+		std::memcpy(&val, pos, sizeof(T));
+		pos += sizeof(T);
+		return val;
+	}
+
+	template <typename L>
+	std::string get_str() {
+		L len = get<L>();
+		if (end - pos < static_cast<long>(len))
+			throw parsing_error {"truncated binary file"};
+		std::string out {pos, len};
+		pos += len;
+		return out;
+	}
+
+	bool at_end() const { return pos == end; }
+private:
+	const char *pos;
+	const char *end;
+};
+
+template <typename T>
+void put(std::string& buf, T val) {
+	buf.append(reinterpret_cast<const char *>(&val), sizeof(T));
+}
+
+template <typename L>
+void put_str(std::string& buf, const std::string& str) {
+	put<L>(buf, str.size());
+	buf += str;
+}
+
+bool write_file_atomic(const std::string& path, const std::string& data);
+
+#endif
@@ -0,0 +1,140 @@
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <array>
+#include <iterator> // for size
+#include <stdexcept>
+#include <cstdint>
+
+#include "eepasm.h"
+#include "builtin_isa.h"
+#include "gen_encode.h"
+
+// The ISA of inslist.eepc compiled into the tools (builtin_isa.h is written
+// by embed_isa at build time, match tables included) with perfect hashes of
+// its mnemonics and of its lit operand names: a seed is searched for at
+// compile time which puts every name into its own slot, so a lookup is one
+// hash, one probe and one compare.
+
+constexpr int num_builtin = std::size(builtin_ins);
+static_assert(num_builtin < 128, "slots hold int8_t instruction indices");
+constexpr int num_builtin_lits = std::size(builtin_lit_names) - 1;
+static_assert(num_builtin_lits < 128, "slots hold int8_t lit ids");
+
+constexpr char low_char(char c) {
+	return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+}
+
+// case insensitive FNV-1a variant, seeded
+constexpr uint32_t phash(std::string_view name, uint32_t seed) {
+	uint32_t hash = seed;
+	for (char c : name)
+		hash = (hash ^ static_cast<unsigned char>(low_char(c))) * 16777619u;
+	return hash ^ (hash >> 16);
+}
+
+// smallest power of two with at least 4 slots per name so a seed without
+// collisions is found after a few tries
+constexpr int phash_bits(int n) {
+	int bits = 0;
+	while ((1 << bits) < 4 * n)
+		bits++;
+	return bits;
+}
+
+template <int n>
+struct phash_table_t {
+	static constexpr uint32_t slot_mask = (1u << phash_bits(n)) - 1;
+	uint32_t seed;
+	std::array<int8_t, slot_mask + 1> slots; // index of the name or -1
+};
+
+// table of the n names name(0) to name(n - 1)
+template <int n, typename F>
+constexpr phash_table_t<n> phash_build(F name) {
+	for (uint32_t seed = 2166136261u;; seed++) {
+		phash_table_t<n> out {seed, {}};
+		out.slots.fill(-1);
+		bool ok = true;
+		for (int i = 0; i < n && ok; i++) {
+			int8_t& slot = out.slots[phash(name(i), seed) & out.slot_mask];
+			ok = slot < 0;
+			slot = i;
+		}
+		if (ok)
+			return out;
+	}
+}
+
+constexpr auto phash_table = phash_build<num_builtin>([](int i) { return builtin_ins[i].name; });
+constexpr auto lit_phash_table = phash_build<num_builtin_lits>([](int i) { return builtin_lit_names[i]; });
+
+// index of the built-in instruction name (any case), -1 if there is none
+int builtin_index(std::string_view name) {
+	int idx = phash_table.slots[phash(name, phash_table.seed) & phash_table.slot_mask];
+	return idx >= 0 && ci_eq(name, builtin_ins[idx].name) ? idx : -1;
+}
+
+// index in builtin_lit_names of the lit name (any case), -1 if there is none
+int builtin_lit_id(std::string_view name) {
+	int idx = lit_phash_table.slots[phash(name, lit_phash_table.seed) & lit_phash_table.slot_mask];
+	return idx >= 0 && ci_eq(name, builtin_lit_names[idx]) ? idx : -1;
+}
+
+insmap_t builtin_isa() {
+	insmap_t outmap;
+	for (int i = 0; i < num_builtin; i++) {
+		const builtin_ins_t& def = builtin_ins[i];
+		insdef_t& ins = outmap[def.name];
+		ins.index = i;
+		ins.const_iword = def.const_iword;
+		for (int a = def.first_alt; a < def.first_alt + def.nalts; a++) {
+			oplist_t& alt = ins.alts.emplace_back();
+			for (int o = builtin_alts[a].first_opd; o < builtin_alts[a].first_opd + builtin_alts[a].nopds; o++) {
+				const builtin_opd_t& opd = builtin_opds[o];
+				alt.push_back({static_cast<optype_t>(opd.type), opd.lsb, opd.size, opd.mask, opd.ins8, opd.lit_const, opd.name});
+			}
+		}
+		ins.lit_hash = builtin_lit_id;
+		ins.lit_ids.assign(num_builtin_lits, 0);
+		for (int l = def.first_lit; l < def.first_lit + def.nlits; l++) {
+			ins.lit_names.push_back(builtin_lits[l]);
+			ins.lit_ids[builtin_lit_ids[l]] = ins.lit_names.size();
+		}
+		ins.nclasses = def.nclasses;
+		for (uint32_t m = def.first_match; m < def.first_match + def.nmatches; m++)
+			ins.match_table.push_back({builtin_matches[m].alt, builtin_matches[m].dup});
+		for (int l = def.first_long; l < def.first_long + def.nlongs; l++)
+			ins.long_form.push_back(builtin_longs[l]);
+	}
+
+	outmap.by_index.resize(num_builtin);
+	for (const auto& [name, ins] : outmap)
+		outmap.by_index[ins.index] = &ins;
+	outmap.perfect_hash = builtin_index;
+	return outmap;
+}
+
+// hash of the config the built-in ISA was made from, same as for the file
+uint64_t builtin_isa_hash() {
+	return builtin_src_hash;
+}
+
+// use the encoders eepasm-gen wrote for every instruction of insmap which
+// is still defined the same way
+void encoders_attach(insmap_t& insmap) {
+	for (int i = 0; i < num_gen_encoders; i++) {
+		const gen_ins_t& gen = gen_encoders[i];
+		auto ins_it = insmap.find(gen.name);
+		if (ins_it != insmap.end() && insdef_hash(ins_it->second) == gen.hash)
+			ins_it->second.encoders.assign(gen.fns, gen.fns + gen.nalts);
+	}
+}
+
+// ISA of conf_file (see isa_load), the built-in one if conf_file is empty
+insmap_t isa_open(const std::string& conf_file) {
+	insmap_t insmap = conf_file.empty() ? builtin_isa() : isa_load(conf_file);
+	encoders_attach(insmap);
+	return insmap;
+}
@@ -0,0 +1,58 @@
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm> // for sort
+#include <bit> // for popcount
+#include <stdexcept>
+#include <cstdint>
+
+#include "eepasm.h"
+
+// Decoding instruction words with the instruction definitions: every
+// alternative fixes the bits outside its operand fields to const_iword plus
+// its lit constants and ins8 bits.
+
+std::vector<altdec_t> alt_decoders(const insmap_t& insmap) {
+	std::vector<altdec_t> out;
+	for (const auto& [name, ins] : insmap) {
+		for (size_t i = 0; i < ins.alts.size(); i++) {
+			uint16_t fields = 0;
+			uint16_t pattern = ins.const_iword;
+			for (const auto& opd : ins.alts[i]) {
+				if (opd.type == optype_t::lit)
+					pattern |= opd.lit_const;
+				else
+					fields |= opd.mask << opd.lsb;
+				pattern |= opd.ins8;
+			}
+			out.push_back({&name, &ins, static_cast<int>(i), static_cast<uint16_t>(~fields), pattern});
+		}
+	}
+
+	// most specific alternative first, then in config order
+	std::sort(out.begin(), out.end(), [](const altdec_t& a, const altdec_t& b) {
+		int a_bits = std::popcount(a.fixed), b_bits = std::popcount(b.fixed);
+		if (a_bits != b_bits)
+			return a_bits > b_bits;
+		if (a.ins->index != b.ins->index)
+			return a.ins->index < b.ins->index;
+		return a.alt < b.alt;
+	});
+	return out;
+}
+
+// first alternative of decoders which iword is an encoding of (nullptr if none)
+const altdec_t *alt_decode(const std::vector<altdec_t>& decoders, uint16_t iword) {
+	for (const auto& dec : decoders)
+		if ((iword & dec.fixed) == dec.pattern)
+			return &dec;
+	return nullptr;
+}
+
+// value of the field of opd in iword, sign extended if sign is set
+int field_get(uint16_t iword, const operand_t& opd, bool sign) {
+	int val = (iword >> opd.lsb) & opd.mask;
+	if (sign && opd.size > 0 && (val >> (opd.size - 1)) & 1)
+		val -= 1 << opd.size;
+	return val;
+}
@@ -0,0 +1,62 @@
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <stdexcept>
+#include <cstdint>
+#include <cctype> // for toupper
+
+#include "dis.h"
+
+constexpr int num_iwords = 1 << 16;
+
+// operands in assembly order; immediates and jump offsets are printed signed
+// if their field is wider than a shift count, so the text assembles back to
+// the same word
+std::string dis_format(const altdec_t& dec, uint16_t iword) {
+	std::string out = *dec.name;
+	for (char& c : out)
+		c = std::toupper(static_cast<unsigned char>(c));
+	const oplist_t& alt = dec.ins->alts[dec.alt];
+	for (size_t i = 0; i < alt.size(); i++) {
+		const operand_t& opd = alt[i];
+		out += i == 0 ? " " : ", ";
+		switch (opd.type) {
+		case optype_t::reg:
+			out += "R" + std::to_string(field_get(iword, opd, false));
+			break;
+		case optype_t::imm:
+		case optype_t::label:
+			out += "#" + std::to_string(field_get(iword, opd, opd.size > 4));
+			break;
+		case optype_t::lit:
+			out += opd.name;
+			break;
+		}
+	}
+	return out;
+}
+
+disassembler::disassembler(const insmap_t& insmap) : decoders {alt_decoders(insmap)}, alt_table(num_iwords, -1) {
+	// every word with the fixed bits of an alternative belongs to it unless
+	// a more specific (earlier) alternative took it already
+	for (size_t i = 0; i < decoders.size(); i++) {
+		uint16_t fields = ~decoders[i].fixed;
+		if (decoders[i].pattern & fields)
+			continue; // can't match any word
+		for (uint16_t sub = fields;; sub = (sub - 1) & fields) {
+			int16_t& entry = alt_table[decoders[i].pattern | sub];
+			if (entry < 0)
+				entry = i;
+			if (sub == 0)
+				break;
+		}
+	}
+
+	text_off.reserve(num_iwords + 1);
+	for (int iword = 0; iword < num_iwords; iword++) {
+		text_off.push_back(texts.size());
+		if (alt_table[iword] >= 0)
+			texts += dis_format(decoders[alt_table[iword]], iword);
+	}
+	text_off.push_back(texts.size());
+}
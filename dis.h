@@ -0,0 +1,40 @@
+#ifndef DIS_H
+#define DIS_H
+
+#include <cstdint>
+#include <iosfwd>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "eepasm.h"
+
+// Disassembler with a table over all 65536 instruction words: the matching
+// alternative and the assembly text of every word are computed once from
+// the instruction definitions, so decoding a word is a single lookup.
+// The instruction map must outlive the disassembler.
+class disassembler {
+public:
+	explicit disassembler(const insmap_t& insmap);
+
+	// alternative iword is an encoding of (nullptr if none)
+	const altdec_t *decode(uint16_t iword) const {
+		return alt_table[iword] < 0 ? nullptr : &decoders[alt_table[iword]];
+	}
+	// assembly text of iword, empty if it encodes no instruction
+	std::string_view text(uint16_t iword) const {
+		return {texts.data() + text_off[iword], text_off[iword + 1] - text_off[iword]};
+	}
+private:
+	std::vector<altdec_t> decoders; // most specific first, see alt_decoders
+	std::vector<int16_t> alt_table; // index into decoders or -1 for every word
+	std::vector<uint32_t> text_off; // start of text of every word in texts
+	std::string texts;
+};
+
+std::string dis_format(const altdec_t& dec, uint16_t iword);
+
+#endif
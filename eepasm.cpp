@@ -9,45 +9,101 @@
 #include <cstdint>
 #include <string>
 #include <sstream>
+#include <string_view>
+#include <chrono>
+#include <cstdlib> // for getenv
+#include <thread> // for hardware_concurrency
 
 #include "eepasm.h"
 
-std::unordered_map<std::string, std::function<bool(const std::string&, std::unordered_map<std::string, std::string>&)>> optype_check_fns {
-	{"reg", reg_check},
-	{"imm", imm_check},
-	{"label", label_check},
-	{"lit", lit_check},
-};
-
-
-std::unordered_map<std::string, std::function<std::unordered_map<std::string, std::string>(std::ifstream&)>> opvec_gen_fns {
-	{"reg", reg_opgen},
-	{"imm", imm_opgen},
-	{"label", no_opgen},
-	{"lit", lit_opgen},
-};
-
-std::unordered_map<std::string, std::function<uint16_t(const std::string&, std::unordered_map<std::string, std::string>&, int)>> optype_fns {
-	{"reg", reg_parse},
-	{"imm", imm_parse},
-	{"label", label_parse},
-	{"lit", lit_parse},
-};
-
-std::unordered_map<std::string, int> label_map;
-
-
 int main(int argc, char *argv[]) {
 
-	std::string insfile = def_insfile;
+	std::string insfile = ""; // built-in ISA
 	std::string outfile_name = def_outfile;
 	std::string infile_name = "";
+	std::vector<std::string> batch_args;
+	unsigned nthreads = 0; // default: number of cores
+	bool outfile_set = false;
+	bool compile_isa = false;
+	bool check_isa = false;
+	bool check_lexer = false;
+	bool alloc_check = false;
+	bool batch = false;
+	bool stream = false;
+	int stats_fmt = 0; // 1: text, 2: JSON
+	asm_opts_t opts;
+	asm_stats_t stats;
+	std::string serve_path = "";
+	std::string connect_path = "";
 	// command line argument parsing
 	for (int i = 1; i < argc; i++) {
-		if (argv[i][0] == '-') {
-			if (argv[i][1] == 'o') {
+		if (argv[i][0] == '-' && argv[i][1] != '\0') { // "-" is stdin
+			if (std::string(argv[i]) == "--stream") {
+				stream = true;
+			} else if (std::string(argv[i]) == "--compile-isa") {
+				if (i + 1 < argc) {
+					insfile = argv[++i];
+					compile_isa = true;
+				} else {
+					usage();
+				}
+			} else if (std::string(argv[i]) == "--check-isa") {
+				check_isa = true;
+			} else if (std::string(argv[i]) == "--check-lexer") {
+				check_lexer = true;
+			} else if (std::string(argv[i]) == "--count-allocs") {
+				alloc_check = true;
+			} else if (std::string(argv[i]) == "--batch") {
+				batch = true;
+			} else if (std::string(argv[i]) == "--stats") {
+				stats_fmt = 1;
+			} else if (std::string(argv[i]) == "--stats-json") {
+				stats_fmt = 2;
+			} else if (std::string(argv[i]) == "--serve" || std::string(argv[i]) == "--connect") {
+				if (i + 1 < argc) {
+					(std::string(argv[i]) == "--serve" ? serve_path : connect_path) = argv[i + 1];
+					i++;
+				} else {
+					usage();
+				}
+			} else if (std::string(argv[i]) == "--symbols") {
+				if (i + 1 < argc) {
+					opts.sym_file = argv[++i];
+				} else {
+					usage();
+				}
+			} else if (std::string(argv[i]) == "--cache-dir") {
+				if (i + 1 < argc) {
+					opts.cache_dir = argv[++i];
+				} else {
+					usage();
+				}
+			} else if (std::string(argv[i]) == "-r") {
+				opts.object = true;
+			} else if (std::string(argv[i]) == "-j") {
+				if (i + 1 < argc) {
+					try {
+						nthreads = threads_parse(argv[++i]);
+					} catch (const assem_error& err) {
+						error(err.what());
+					}
+				} else {
+					usage();
+				}
+			} else if (argv[i][1] == 'f') {
+				if (i + 1 < argc) {
+					try {
+						opts.fmt = outfmt_parse(argv[++i]);
+					} catch (const assem_error& err) {
+						error(err.what());
+					}
+				} else {
+					usage();
+				}
+			} else if (argv[i][1] == 'o') {
 				if (i + 1 < argc) {
 					outfile_name = argv[++i];
+					outfile_set = true;
 				} else {
 					usage();
 				}
@@ -63,236 +119,137 @@ int main(int argc, char *argv[]) {
 			}
 		} else {
 			infile_name = argv[i];
+			batch_args.push_back(argv[i]);
 		}
 	}
 
-	if (infile_name == "") {
-		usage();
+	if (compile_isa) {
+		isa_compile(insfile, outfile_set ? outfile_name : isa_cache_path(insfile));
+		return 0;
 	}
 
-	insmap_t insmap = insmap_gen(insfile);
-
-	std::ifstream infile {infile_name};
-	if (!infile.is_open())
-		error("can't open input file '" + infile_name + "'");
-
-	auto [tok_vec, label_map] = tokenize_file(infile, insmap);
-	infile.close();
-
-	std::ofstream outfile {outfile_name};
-	if (!outfile.is_open())
-		error("can't open output file '" + outfile_name + "'");
-
+	if (check_isa) {
+		return isa_check(isa_open(insfile), std::cout) ? 0 : EXIT_FAILURE;
+	}
 
-	int pc = 0, iword;
-	int line = 0;
-	std::vector<oplist_t> ins_alts;
-	for (const auto& tokens : tok_vec) {
-		line++;
+	if (check_lexer) {
+		if (infile_name == "")
+			usage();
+		file_map src {infile_name};
+		if (!src.is_open())
+			error("can't open input file '" + infile_name + "'");
 		try {
-			if (tokens[0] == "org") {
-				pc = num_parse(tokens[1]);
-				continue;
-			} else if (insmap.find(tokens[0]) == insmap.end()) {
-				throw assem_error {"unknown instruction"};
-			}
-
-			ins_alts = insmap[tokens[0]].first;
-			iword = insmap[tokens[0]].second;
-			if (ins_alts.size() != 0) {
-
-				int alt_idx = 0;
-				// skip to first instruction alternative with correct number
-				// of operands
-				while (ins_alts[alt_idx].size() != tokens.size() - 1) {
-					alt_idx++;
-					if (alt_idx >= ins_alts.size()) {
-						throw assem_error {"no matching version of instruction found"};
-					}
-				}
-				// select first alternative with matching number of operands
-				if (ins_alts[alt_idx].size() == tokens.size() - 1) {
-
-					// these indexes can differ if a 2 operand shorthand
-					// of a 3 operand instruction is encountered:
-					// index of operand in current alternative
-					int alt_op = 0;
-					// index of operand in current tokens vector
-					int tok_op = 1; // starts at first operand in token vector
-					// needed to skip already processed Ra if we go back
-					// by one operand for Rc of 3 operand instruction
-					// with 2 operand shorthand
-					bool alt_op_skip = false;
-					for (; tok_op < tokens.size(); tok_op++, alt_op++) {
-						// go to next alternative if current operand does not match requirement
-						while (!optype_check_fns[ins_alts[alt_idx][alt_op]["type"]](tokens[tok_op], ins_alts[alt_idx][alt_op])) {
-							alt_idx++;
-							if (alt_idx >= ins_alts.size()) {
-								throw assem_error {"no matching version of instruction found"};
-							}
-							if (ins_alts[alt_idx].size() > tokens.size() - 1) {
-								// try 3 operand instruction by duplicating first operand
-								if (ins_alts[alt_idx].size() == tokens.size()) {
-									tok_op--;
-									alt_op = tok_op - 1;
-									alt_op_skip = true;
-									if (tok_op == 0) {
-										throw assem_error {"no matching version of instruction found"};
-									}
-								} else {
-									throw assem_error {"no matching version of instruction found"};
-								}
-							}
-						}
-
-
-						iword += optype_fns[ins_alts[alt_idx][alt_op]["type"]](tokens[tok_op], ins_alts[alt_idx][alt_op], pc);
-
-
-						if (alt_op_skip) {
-							alt_op++;
-							alt_op_skip = false;
-						}
-					}
-				} else {
-					throw assem_error {"no matching version of instruction found"};
-				}
-			}
-
-			outfile << ins2str(pc, iword) << "\n";
-			pc++;
+			return scanners_check(src.view(), std::cout) ? 0 : EXIT_FAILURE;
 		} catch (const assem_error& err) {
-			error("assembly instruction " + std::to_string(line) + " (" + tokens[0] + "): " + err.what());
+			error(err.what());
 		}
 	}
- 	outfile.close();
-}
-
-void usage() {
-	error("Usage: eepasm [-o outfile] [-c configfile] infile");
-}
 
-void error(const std::string& msg) {
-	std::cerr << "Error: " << msg << std::endl;
-	std::exit(EXIT_FAILURE);
-}
-
-
-
-insmap_t insmap_gen(const std::string& conf_file) {
-	std::ifstream cfile {conf_file};
-	if (!cfile.is_open())
-		error("Can't open instruction list config file '" + conf_file + "'");
-
-	insmap_t outmap;
-	std::vector<oplist_t> alternatives_vec;
-	std::string ins_name, instr;
-	int numops;
-
-	while ((ins_name = get_low_str(cfile)) != "") {
-		// process instructions stored in instr
-	
+	if (alloc_check) {
+		if (infile_name == "")
+			usage();
 		try {
-			instr = get_low_str(cfile);
-			if (instr == "copy") {
-				outmap[ins_name].first = alternatives_vec;
-				instr = get_low_str(cfile);
-			} else if (instr == "numops") {
-				alternatives_vec.clear();
-				while (instr == "numops") {
-					cfile >> numops; // numops value
-					if (numops > 3)
-						throw parsing_error {"can't have more than 3 operands"};
-					alternatives_vec.push_back(opvec_gen(cfile, numops));
-					instr = get_low_str(cfile);
-				}
-				outmap[ins_name].first = alternatives_vec;
-			}
-
-			// while already read string const_iword
-			if (instr != "const_iword")
-				throw parsing_error {"missing const_iword field"};
-			instr = get_low_str(cfile); // string of const_iword
-			outmap[ins_name].second = num_parse(instr);
-		} catch (const parsing_error& err) {
-			error("parsing (" + ins_name + "): " + err.what());
+			return count_allocs(isa_open(insfile), infile_name, std::cout) ? 0 : EXIT_FAILURE;
+		} catch (const assem_error& err) {
+			error(err.what());
 		}
 	}
 
-	return outmap;
-}
-
-oplist_t opvec_gen(std::ifstream& cfile, int numops) {
-	oplist_t outvec;
-	std::unordered_map<std::string, std::string> opfield_map;
-	std::string instr, type;
-
+	if (serve_path != "") {
+		return serve(serve_path, nthreads);
+	}
 
-	for (int i = 0; i < numops; i++) {
-		instr = get_low_str(cfile);
-		if (instr != "op")
-			throw parsing_error {"missing op indicator"};
+	if (opts.cache_dir != "") {
+		// cached regions are only valid for the same ISA
+		if (insfile == "") {
+			opts.isa_hash = builtin_isa_hash();
+		} else {
+			file_map conf {insfile};
+			opts.isa_hash = fnv1a_hash(conf.data(), conf.size());
+		}
+	}
 
-		instr = get_low_str(cfile);
-		if (instr != "type")
-			throw parsing_error {"type field missing"};
+	if (batch) {
+		if (batch_args.empty() || stats_fmt || opts.sym_file != "" || (opts.object && opts.cache_dir != ""))
+			usage();
+		insmap_t insmap = isa_open(insfile);
+		auto jobs = batch_jobs(batch_args, outfile_set ? outfile_name : "", opts.object ? obj_ext : outfmt_ext(opts.fmt));
+		return batch_assemble(insmap, jobs, nthreads, opts) ? 0 : EXIT_FAILURE;
+	}
 
-		type = get_low_str(cfile);
-		if (opvec_gen_fns.find(type) == opvec_gen_fns.end())
-			throw parsing_error {"invaid operand type"};
+	if (infile_name == "") {
+		usage();
+	}
+	if (opts.object && (stream || infile_name == "-" || opts.cache_dir != ""))
+		error("-r needs an input file assembled in one piece (no --stream, stdin or --cache-dir)");
+	if (!outfile_set)
+		outfile_name = opts.object ? replace_ext(infile_name, obj_ext) : replace_ext(def_outfile, outfmt_ext(opts.fmt));
+	if (stats_fmt && (stream || infile_name == "-"))
+		error("--stats needs an input file assembled in one piece (no --stream or stdin)");
+	// a large source is encoded on all cores
+	opts.threads = nthreads ? nthreads : std::max(1u, std::thread::hardware_concurrency());
+	job_t job {insfile, infile_name, outfile_name, stream, stats_fmt, opts};
+
+	if (connect_path == "" && std::getenv("EEPASM_SOCKET"))
+		connect_path = std::getenv("EEPASM_SOCKET");
+	if (connect_path != "") {
+		int status;
+		if (serve_client(connect_path, job, status))
+			return status;
+		// no server: assemble here
+	}
 
-		opfield_map = opvec_gen_fns[type](cfile);
-		opfield_map["type"] = type;
-	
-		outvec.push_back(opfield_map);
+	auto config_start = std::chrono::steady_clock::now();
+	insmap_t insmap = isa_open(insfile);
+	if (stats_fmt)
+		stats.config = std::chrono::duration<double>(std::chrono::steady_clock::now() - config_start).count();
+
+	if (infile_name == "-")
+		std::ios::sync_with_stdio(false);
+	try {
+		job_run(insmap, job, std::cin, std::cerr, stats);
+	} catch (const assem_error& err) {
+		error(err.what());
 	}
-	return outvec;
 }
 
+// assemble the input of job (read from in if it is "-"); --stats output goes
+// to err, stats.config is set by the caller
+void job_run(const insmap_t& insmap, const job_t& job, std::istream& in, std::ostream& err, asm_stats_t& stats) {
+	auto start = std::chrono::steady_clock::now();
+	asm_opts_t opts = job.opts;
+	if (job.stats_fmt)
+		opts.stats = &stats;
+
+	if (job.infile_name == "-") {
+		assemble_stream(insmap, in, job.outfile_name, opts);
+	} else if (job.stream) {
+		std::ifstream infile {job.infile_name};
+		if (!infile.is_open())
+			throw assem_error {"can't open input file '" + job.infile_name + "'"};
+		assemble_stream(insmap, infile, job.outfile_name, opts, job.infile_name);
+	} else {
+		assemble_file(insmap, job.infile_name, job.outfile_name, opts);
+	}
 
-std::pair<tokvec_t, labelmap_t> tokenize_file(std::ifstream& infile, const insmap_t& insmap) {
-	tokvec_t outvec;
-	labelmap_t labelmap;
-
-	std::string line, token;
-	std::istringstream line_stream;
-	std::vector<std::string> token_vec;
-	int pc = 0;
-	while (getline(infile, line)) {
-		line_strip(line);
-		if (line == "")
-			continue;
-		line_stream.clear(); // clear state flags
-		line_stream.str(line);
-		token_vec.clear();
-
-		token = get_low_str(line_stream);
-		if (insmap.find(token) == insmap.end() && token != "org") {
-			label_map[token] = pc;
-			std::string lower_stream_str = line_stream.str();
-			transform(lower_stream_str.begin(), lower_stream_str.end(), lower_stream_str.begin(), [](char c) { return tolower(c); });
-			if (lower_stream_str == token) { // if label on separate line
-				continue; // need to skip incrementing pc
-			}
-		} else {
-			token_vec.push_back(token);
-		}
-		if (token == "org") {
-			token = get_low_str(line_stream);
-			pc = num_parse(token);
-			token_vec.push_back(token);
-		} else {
-			pc++;
-				
-			while ((token = get_low_str(line_stream)) != "") {
-				while (token[0] == '#' || token [0] == '[')
-					token = token.replace(0, 1, "");
-				if (token[token.size()-1] == ',' || token[token.size()-1] == ']')
-					token = token.replace(token.size()-1, token.size(), "");
-				token_vec.push_back(token);
-			}
-		}
-		outvec.push_back(token_vec);
+	if (job.stats_fmt) {
+		stats.total = stats.config + std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		stats.peak_rss_kb = peak_rss_kb();
+		stats_print(stats, job.stats_fmt == 2, err);
 	}
-	return make_pair(outvec, labelmap);
+}
+
+void usage() {
+	error("Usage: eepasm [-o outfile] [-c configfile] [-f format] [--symbols symfile] [--cache-dir dir] [-j threads] [--stats|--stats-json] infile\n"
+		"       eepasm -r [-o objfile] [-c configfile] [--symbols symfile] [--stats|--stats-json] infile\n"
+		"       eepasm [-o outfile] [-c configfile] [-f format] [--symbols symfile] [--stream] infile|-\n"
+		"       eepasm --compile-isa configfile [-o binfile]\n"
+		"       eepasm --check-isa [-c configfile]\n"
+		"       eepasm --check-lexer infile\n"
+		"       eepasm --count-allocs [-c configfile] infile\n"
+		"       eepasm --serve socket [-j threads]\n"
+		"       eepasm --connect socket [options of the first two forms]\n"
+		"       eepasm --batch [-j threads] [-o outdir] [-c configfile] [-f format|-r] [--cache-dir dir] infile|@manifest...\n"
+		"formats: ram, raw, rawbe, ihex, sparse\n"
+		"without -c the instruction list built into the binary is used");
 }
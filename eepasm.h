@@ -1,15 +1,349 @@
 #ifndef EEPASM_H
 #define EEPASM_H
 
-using oplist_t = std::vector<std::unordered_map<std::string, std::string>>;
-using insmap_t = std::unordered_map<std::string, std::pair<std::vector<oplist_t>, uint16_t>>;
-using labelmap_t = std::unordered_map<std::string, int>;
-using tokvec_t = std::vector<std::vector<std::string>>;
-
 constexpr char def_insfile[] = "inslist.eepc";
 constexpr char def_outfile[] = "out.ram";
+constexpr char isa_bin_ext[] = ".eepb";
+constexpr unsigned max_threads = 1024; // most threads of -j
+constexpr uint64_t fnv_offset = 0xcbf29ce484222325ULL;
 constexpr int regsize = 3;
 constexpr int offset_size = 8;
+constexpr int max_ops = 3;
+constexpr int max_line_toks = max_ops + 2;
+
+// operand kinds as given by the 'type' field of an operand in the config
+enum class optype_t : uint8_t { reg, imm, label, lit };
+constexpr int num_optypes = 4;
+
+// operand descriptor with all numeric config fields parsed at load time
+struct operand_t {
+	optype_t type;
+	uint8_t lsb = 0; // least significant bit of field in instruction word
+	uint8_t size = 0; // field size in bits
+	uint16_t mask = 0; // (1 << size) - 1, applied before shifting to lsb
+	uint16_t ins8 = 0; // 1 << 8 if instruction bit 8 must be set, else 0
+	uint16_t lit_const = 0; // value added to instruction word for lit operands
+	std::string name; // name of lit operands
+};
+
+using oplist_t = std::vector<operand_t>;
+
+// alternative selected for one combination of operand classes
+struct match_t {
+	int8_t alt = -1; // index of alternative, -1 if none matches
+	bool dup = false; // 2 operand shorthand: first operand is duplicated
+};
+
+// case insensitive hash and comparison so source tokens can be looked up
+// without lowercasing (and copying) them first
+struct ci_hash {
+	using is_transparent = void;
+	size_t operator()(std::string_view str) const;
+};
+
+struct ci_equal {
+	using is_transparent = void;
+	bool operator()(std::string_view a, std::string_view b) const;
+};
+
+// label of a symbol table
+struct symbol_t {
+	std::string_view name; // spelling of the definition, points into the source text
+	int value = -1; // address, -1 while undefined
+	int line = 0; // line of the definition
+	bool absolute = false; // defined after an org, else relative to the start of its file
+	int index = -1; // token record it precedes once linked, see relax.cpp
+};
+
+// labels interned once: every name (any case) gets a dense id, its index in
+// syms, when it is first defined or used as an operand. tokenize_file keeps
+// the id of a label operand in its tokens so encoding reads the address by
+// index instead of hashing the name again.
+struct symtab_t {
+	std::unordered_map<std::string_view, int, ci_hash, ci_equal> ids;
+	std::vector<symbol_t> syms;
+
+	int intern(std::string_view name);
+	int define(std::string_view name, int value, int line); // id, assem_error if already defined
+	int value(std::string_view name) const; // -1 if undefined
+};
+
+struct tokline_t;
+struct unresolved_t;
+
+// encoder of one alternative written by eepasm-gen, see encode_line
+using encode_fn_t = uint16_t (*)(const oplist_t& alt, const tokline_t& tokens, bool dup, int pc, const symtab_t& labels, std::vector<unresolved_t> *unresolved);
+
+struct insdef_t {
+	std::vector<oplist_t> alts;
+	uint16_t const_iword = 0;
+	int index = 0; // position in the config file
+	std::vector<std::string> lit_names; // distinct names of lit operands in alts
+	int (*lit_hash)(std::string_view name) = nullptr; // perfect hash of the lit names of the built-in ISA, id or -1
+	std::vector<int8_t> lit_ids; // 1 + index in lit_names by id of lit_hash, 0 if not one of them
+	int nclasses = 0; // number of operand classes
+	std::vector<match_t> match_table; // see match_table.cpp
+	std::vector<encode_fn_t> encoders; // specialized encoder per alternative, empty: generic
+	std::vector<std::string> long_form; // lines replacing it if its label is out of reach, see relax.cpp
+};
+
+// phase times (seconds) and counters of one assembly job (--stats)
+struct asm_stats_t {
+	double config = 0, tokenize = 0, encode = 0, output = 0, total = 0;
+	long lines = 0; // source lines, of included files at every include
+	long instructions = 0; // encoded, lines of long forms included
+	long tokens = 0;
+	long labels = 0;
+	long map_lookups = 0; // instruction and label hash map lookups and inserts
+	long hash_probes = 0; // instruction lookups through the perfect hash of the built-in ISA
+	long alts_tried = 0; // match table lookups
+	long shorthand = 0; // instructions matched by the 2 operand shorthand
+	size_t bytes_written = 0;
+	long peak_rss_kb = 0;
+	size_t ir_bytes = 0; // token records kept between the passes
+};
+
+
+// instruction definitions by mnemonic. The built-in ISA sets perfect_hash
+// so lookup() is a single probe (see builtin.cpp). Only movable: by_index
+// points into the map.
+struct insmap_t : std::unordered_map<std::string, insdef_t, ci_hash, ci_equal> {
+	int (*perfect_hash)(std::string_view name) = nullptr; // index or -1
+	std::vector<const insdef_t *> by_index; // by insdef_t::index
+
+	insmap_t() = default;
+	insmap_t(insmap_t&&) = default;
+	insmap_t& operator=(insmap_t&&) = default;
+	insmap_t(const insmap_t&) = delete;
+	insmap_t& operator=(const insmap_t&) = delete;
+
+	// counted in stats if given (--stats)
+	const insdef_t *lookup(std::string_view name, asm_stats_t *stats = nullptr) const {
+		if (perfect_hash) {
+			if (stats)
+				stats->hash_probes++;
+			int idx = perfect_hash(name);
+			return idx < 0 ? nullptr : by_index[idx];
+		}
+		if (stats)
+			stats->map_lookups++;
+		auto it = find(name);
+		return it == end() ? nullptr : &it->second;
+	}
+};
+
+// token of a source line: position in the line text
+struct token_t {
+	uint16_t off; // column - 1
+	uint16_t len;
+};
+
+// tokens of one source line: mnemonic (or org) followed by the operands.
+// A fixed-size record (48 bytes on 64 bit hosts): the tokens are offsets
+// into the line, whose text stays in the source buffer, and the instruction
+// definition is only referenced.
+struct tokline_t {
+	const char *text; // start of the source line
+	const insdef_t *ins; // definition of the mnemonic if already looked up
+	int line; // source line number starting at 1
+	token_t tokens[max_line_toks]; // one spare to detect too many operands
+	int label_sym; // symbol id of operand label_op
+	uint16_t ntok; // number of tokens, may exceed max_line_toks
+	bool region_start; // first line after a label or org
+	int8_t label_op; // operand interned by tokenize_file, -1 if none
+
+	std::string_view tok(int i) const { return {text + tokens[i].off, tokens[i].len}; }
+	int col(int i) const { return tokens[i].off + 1; }
+	int nops() const { return ntok - 1; }
+	std::string_view op(int i) const { return tok(i + 1); }
+};
+
+using tokvec_t = std::vector<tokline_t>;
+
+// label operands are signed 8 bit offsets from the pc of their instruction,
+// addresses wrap around at 16 bits
+constexpr int label_min = -128;
+constexpr int label_max = 127;
+
+inline int label_offset(int value, int pc) {
+	return static_cast<int16_t>(value - pc);
+}
+
+// address of the label in operand tok_op of tokens, -1 if undefined
+inline int label_value(const tokline_t& tokens, int tok_op, const symtab_t& labels) {
+	return tokens.label_op == tok_op ? labels.syms[tokens.label_sym].value : labels.value(tokens.op(tok_op));
+}
+
+// tokens and labels of one source file as lexed by file_lex. Included
+// files are kept as modules in a module cache (see module_cache.h).
+struct module_t {
+	std::string path; // as first included, for messages
+	std::string text; // tokens point into it, empty for the main source
+	tokvec_t tok_vec; // include lines are kept as records
+	symtab_t labels; // value: index in tok_vec of the record after the definition
+	std::vector<int> defs; // ids of the defined labels in source order
+	bool has_include = false;
+	asm_stats_t stats; // lexing counters of included files, see module_link
+};
+
+class module_cache_t;
+class module_refs_t;
+
+// token vector and labels of a source being put together from its modules
+struct link_state_t {
+	tokvec_t out;
+	symtab_t labels;
+	int pc = 0;
+	bool org_seen = false; // labels after it are absolute
+	bool region_start = true; // next record starts a region
+	std::vector<std::string> open_files; // real paths of the files being linked
+	asm_stats_t *stats = nullptr; // --stats counters of the job if given
+	module_refs_t *modules = nullptr; // where included files come from
+};
+
+// label operand which could not be resolved while encoding
+struct unresolved_t {
+	std::string_view label;
+	const operand_t *opd;
+};
+
+enum class outfmt_t { ram, raw_le, raw_be, ihex, sparse };
+
+constexpr char obj_ext[] = ".eepo";
+constexpr int sym_undef = -1; // obj_symbol_t::section of imported symbols
+constexpr int sym_abs = -2; // obj_symbol_t::section of symbols at fixed addresses
+
+// section of a relocatable object: the words before the first org are
+// placed by the linker, every org starts a fixed section at its address
+struct obj_section_t {
+	bool fixed = false;
+	int addr = 0; // if fixed
+	std::vector<uint16_t> words;
+};
+
+// label defined (exported) or only used (imported) by an object
+struct obj_symbol_t {
+	std::string name;
+	int section; // index, sym_abs or sym_undef
+	int value; // offset in the section, the address for sym_abs
+	int line; // of the definition
+};
+
+// label operand left to the linker: the offset from the address of the word
+// to the symbol is added in the field of size bits at lsb
+struct obj_reloc_t {
+	int section;
+	int word; // index in the section
+	int symbol;
+	uint8_t lsb;
+	uint8_t size;
+};
+
+struct object_t {
+	std::string source; // file name, for messages
+	std::vector<obj_section_t> sections; // sections[0] is the relocatable one
+	std::vector<obj_symbol_t> symbols;
+	std::vector<obj_reloc_t> relocs;
+};
+
+// options of one assembly job
+struct asm_opts_t {
+	outfmt_t fmt = outfmt_t::ram;
+	std::string cache_dir; // incremental reassembly cache, none if empty
+	uint64_t isa_hash = 0; // hash of the ISA config, part of cache keys
+	asm_stats_t *stats = nullptr; // filled by assemble_file if given
+	int out_fd = 1; // file descriptor written for output path "-"
+	std::ostream *log = nullptr; // --cache-dir messages, std::cerr if null
+	std::string sym_file; // --symbols: symbol table written here if not empty, "-" is out_fd
+	bool object = false; // -r: write a relocatable object instead of an image
+	unsigned threads = 1; // encoding threads for large sources, see encode_parallel
+	module_cache_t *modules = nullptr; // included files shared with other jobs of the ISA, none if null
+};
+
+// one run of eepasm without --batch, --compile-isa or --check-isa: done by
+// main or, with --connect, by the server (see serve.cpp)
+struct job_t {
+	std::string insfile; // empty: built-in ISA
+	std::string infile_name; // "-" is stdin
+	std::string outfile_name; // "-" is opts.out_fd
+	bool stream = false;
+	int stats_fmt = 0; // 1: text, 2: JSON
+	asm_opts_t opts;
+};
+
+// assembled words in one of the output formats written through one large
+// buffer; the image formats collect all words and are written by close()
+class out_writer {
+public:
+	out_writer(const std::string& path, outfmt_t fmt, int stdout_fd = 1); // path "-" is stdout_fd
+	~out_writer();
+	out_writer(const out_writer&) = delete;
+	out_writer& operator=(const out_writer&) = delete;
+
+	long put(int pc, uint16_t iword); // returns handle for patch
+	void put_text(std::string_view lines) { write_bytes(lines.data(), lines.size()); } // ram format lines
+	void patch(long handle, int pc, uint16_t iword);
+	void close();
+
+	void time_writes() { timed = true; } // add up time spent writing the file
+	double write_time() const { return write_secs; }
+	size_t bytes_written() const { return flushed; }
+private:
+	static constexpr int image_size = 1 << 16;
+
+	void flush();
+	char *reserve(size_t len);
+	void write_bytes(const char *data, size_t len);
+	void ihex_record(int type, unsigned addr, const uint8_t *data, int len);
+	void write_raw(bool big_endian);
+	void write_ihex();
+	void write_sparse();
+
+	outfmt_t fmt;
+	std::string path;
+	int fd = -1;
+	std::vector<char> buf;
+	size_t fill = 0; // bytes used in buf
+	size_t flushed = 0; // bytes written to file
+	bool timed = false;
+	double write_secs = 0;
+	std::vector<uint16_t> image;
+	std::vector<bool> used;
+};
+
+// read-only memory mapping of a whole file, unmapped when it goes out of scope
+class file_map {
+public:
+	file_map(const std::string& path);
+	~file_map();
+	file_map(const file_map&) = delete;
+	file_map& operator=(const file_map&) = delete;
+
+	const char *data() const { return addr; }
+	size_t size() const { return len; }
+	std::string_view view() const { return {addr, len}; }
+	bool is_open() const { return opened; }
+private:
+	const char *addr = nullptr;
+	size_t len = 0;
+	bool opened = false;
+};
+
+// assembled program read back from one of the output formats
+struct mem_image_t {
+	std::vector<uint16_t> words; // 1 << 16 words
+	std::vector<bool> used; // word was part of the image
+};
+
+// one alternative of an instruction seen from the decoding side: a word is
+// an encoding of it if (word & fixed) == pattern
+struct altdec_t {
+	const std::string *name;
+	const insdef_t *ins;
+	int alt;
+	uint16_t fixed; // bits outside of any operand field
+	uint16_t pattern;
+};
 
 void usage();
 void error(const std::string& msg);
@@ -24,31 +358,128 @@ public:
 	assem_error(const std::string& what_arg) : std::runtime_error {what_arg} {}
 };
 
+// number of a register operand, which must be r0 to r7: reg_check only
+// looks at the first letter
+inline int reg_num(std::string_view op) {
+	if (op.size() != 2 || op[1] < '0' || op[1] > '7')
+		throw assem_error {"invalid register '" + std::string {op} + "'"};
+	return op[1] - '0';
+}
+
+// assem_error of one source line (what() is line_error) with the parts of
+// the message kept apart for callers reporting them separately
+class source_error : public assem_error {
+public:
+	source_error(const tokline_t& tokens, const std::string& msg);
+	source_error(int line, const std::string& msg); // whole line
+	source_error(const source_error& err, const std::string& file); // err in an included file
+
+	int line;
+	int col;
+	std::string token; // first token of the line
+	std::string msg;
+	std::string file; // included file of the line, empty for the main source or if not located yet
+	const char *text = nullptr; // start of the line, see module_refs_t::locate
+};
+
 insmap_t insmap_gen(const std::string& conf_file);
-oplist_t opvec_gen(std::ifstream& cfile, int numops);
+insmap_t isa_parse(std::istream& cfile);
+oplist_t opvec_gen(std::istream& cfile, int numops);
+uint8_t field_parse(const std::string& instr, int max);
+
+uint64_t fnv1a_hash(const char *data, size_t len, uint64_t hash = fnv_offset);
+std::string isa_cache_path(const std::string& conf_file);
+void isa_compile(const std::string& conf_file, const std::string& out_file);
+insmap_t isa_read(const std::string& conf_file);
+insmap_t isa_load(const std::string& conf_file);
+insmap_t isa_open(const std::string& conf_file);
+insmap_t builtin_isa();
+uint64_t builtin_isa_hash();
+uint64_t insdef_hash(const insdef_t& ins);
+void encoders_attach(insmap_t& insmap);
 
 std::string get_low_str(std::istream& infile);
-std::string get_cfile_val(std::ifstream& cfile, const std::string& field_name);
+std::string get_cfile_val(std::istream& cfile, const std::string& field_name);
 void line_strip(std::string& line);
-std::pair<tokvec_t, labelmap_t> tokenize_file(std::ifstream& infile, const insmap_t& insmap);
+bool ci_eq(std::string_view a, std::string_view b);
+tokline_t scan_line(std::string_view line, int line_no);
+
+// token scanner of scan_line, see scan.cpp
+struct scanner_t {
+	const char *name;
+	void (*fn)(std::string_view line, tokline_t& out);
+};
+
+const std::vector<scanner_t>& scanners();
+void scan_tokens(std::string_view line, tokline_t& out);
+bool scanners_check(std::string_view src, std::ostream& out);
+void file_lex(std::string_view src, const insmap_t& insmap, module_t& out, asm_stats_t *stats = nullptr);
+std::pair<tokvec_t, symtab_t> tokenize_file(std::string_view src, const insmap_t& insmap, module_refs_t& modules, const std::string& src_path = "", unsigned nthreads = 1, asm_stats_t *stats = nullptr);
+bool is_include(const tokline_t& tokens);
+std::string include_path(const tokline_t& tokens, const std::string& src_path);
+void module_link(const module_t& mod, const std::string& path, bool main, const insmap_t& insmap, link_state_t& ln);
+std::string line_error(const tokline_t& tokens, const std::string& msg);
+bool is_org(const tokline_t& tokens);
+int org_parse(const tokline_t& tokens);
+int label_operand(const tokline_t& tokens);
+std::string_view strip_label(tokline_t& tokens, const insmap_t& insmap, asm_stats_t *stats = nullptr);
+uint16_t encode_line(const insmap_t& insmap, const tokline_t& tokens, int pc, const symtab_t& labels, std::vector<unresolved_t> *unresolved = nullptr, asm_stats_t *stats = nullptr);
 std::string ins2str(int pc, uint16_t iword);
+char *put_hex(char *out, unsigned val, int min_digits, bool upper = false);
+char *put_ram_line(char *out, int pc, uint16_t iword);
+outfmt_t outfmt_parse(const std::string& name);
+std::string outfmt_ext(outfmt_t fmt);
+std::string replace_ext(const std::string& path, const std::string& ext);
+outfmt_t image_detect(std::string_view data);
+mem_image_t image_parse(std::string_view data, outfmt_t fmt);
+mem_image_t image_load(const std::string& path);
+mem_image_t image_load(const std::string& path, outfmt_t fmt);
+
+std::vector<altdec_t> alt_decoders(const insmap_t& insmap);
+const altdec_t *alt_decode(const std::vector<altdec_t>& decoders, uint16_t iword);
+int field_get(uint16_t iword, const operand_t& opd, bool sign);
+
+object_t object_build(const insmap_t& insmap, const tokvec_t& tok_vec, const symtab_t& labels, const std::string& source, asm_stats_t *stats = nullptr);
+std::string obj_serialize(const object_t& obj);
+void obj_save(const object_t& obj, const std::string& path);
+object_t obj_load(const std::string& path);
+void assemble_file(const insmap_t& insmap, const std::string& infile_name, const std::string& outfile_name, const asm_opts_t& opts);
+void encode_cached(const insmap_t& insmap, const tokvec_t& tok_vec, const symtab_t& label_map, out_writer& outfile, const std::string& infile_name, const asm_opts_t& opts);
+void assemble_stream(const insmap_t& insmap, std::istream& infile, const std::string& outfile_name, const asm_opts_t& opts, const std::string& src_path = "");
+std::vector<std::pair<std::string, std::string>> batch_jobs(const std::vector<std::string>& args, const std::string& outdir, const std::string& ext);
+void job_run(const insmap_t& insmap, const job_t& job, std::istream& in, std::ostream& err, asm_stats_t& stats);
+int serve(const std::string& sock_path, unsigned nthreads);
+bool serve_client(const std::string& sock_path, const job_t& job, int& status);
+bool batch_assemble(const insmap_t& insmap, const std::vector<std::pair<std::string, std::string>>& jobs, unsigned nthreads, const asm_opts_t& opts);
+
+uint16_t num_parse(std::string_view instr);
+unsigned threads_parse(std::string_view arg);
 
-uint16_t num_parse(const std::string& instr);
+void stats_add(asm_stats_t& to, const asm_stats_t& from);
+long peak_rss_kb();
+bool count_allocs(const insmap_t& insmap, const std::string& infile_name, std::ostream& out);
+void stats_print(const asm_stats_t& stats, bool json, std::ostream& out);
 
-uint16_t reg_parse(const std::string& reg_name, std::unordered_map<std::string, std::string>& opfield_map, int pc);
-uint16_t imm_parse(const std::string& imm_op, std::unordered_map<std::string, std::string>& opfield_map, int pc);
-uint16_t label_parse(const std::string& label, std::unordered_map<std::string, std::string>& opfield_map, int pc);
-uint16_t lit_parse(const std::string& op, std::unordered_map<std::string, std::string>& opfield_map, int pc);
+uint16_t reg_parse(std::string_view reg_name, const operand_t& opd, int pc, const symtab_t& labels);
+uint16_t imm_parse(std::string_view imm_op, const operand_t& opd, int pc, const symtab_t& labels);
+uint16_t label_parse(std::string_view label, const operand_t& opd, int pc, const symtab_t& labels);
+uint16_t label_encode(std::string_view label, int value, int pc);
+void relax(const insmap_t& insmap, tokvec_t& tok_vec, symtab_t& labels, std::string& text, asm_stats_t *stats = nullptr);
+void symtab_write(const symtab_t& labels, std::ostream& out);
+void symtab_save(const symtab_t& labels, const std::string& path, int stdout_fd = 1);
+uint16_t lit_parse(std::string_view op, const operand_t& opd, int pc, const symtab_t& labels);
 
-bool reg_check(const std::string& op, std::unordered_map<std::string, std::string>& opmap);
-bool imm_check(const std::string& op, std::unordered_map<std::string, std::string>& opmap);
-bool label_check(const std::string& op, std::unordered_map<std::string, std::string>& opmap);
-bool lit_check(const std::string& op, std::unordered_map<std::string, std::string>& opmap);
+bool reg_check(std::string_view op);
+bool imm_check(std::string_view op);
 
-std::unordered_map<std::string, std::string> reg_opgen(std::ifstream& cfile);
-std::unordered_map<std::string, std::string> imm_opgen(std::ifstream& cfile);
-std::unordered_map<std::string, std::string> lit_opgen(std::ifstream& cfile);
-std::unordered_map<std::string, std::string> no_opgen(std::ifstream& cfile);
+int op_class(std::string_view op, const insdef_t& ins);
+void match_table_gen(insdef_t& ins);
+match_t ins_match(const insdef_t& ins, const tokline_t& tokens);
+int lit_idx(const insdef_t& ins, std::string_view name);
+bool isa_check(const insmap_t& insmap, std::ostream& out);
 
-extern std::unordered_map<std::string, int> label_map;
+operand_t reg_opgen(std::istream& cfile);
+operand_t imm_opgen(std::istream& cfile);
+operand_t lit_opgen(std::istream& cfile);
+operand_t no_opgen(std::istream& cfile);
 #endif
@@ -0,0 +1,86 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm> // for sort
+#include <stdexcept>
+#include <cstdint>
+
+#include "eepasm.h"
+
+// Ahead of time ISA compiler: writes C++ with one encoder per alternative
+// of every instruction of a config file, field positions and masks as
+// template arguments of opd_encode (gen_encode.h). The tools built with it
+// use these encoders for every instruction which is defined the same way
+// at run time (see encoders_attach) and the generic ones otherwise.
+
+constexpr const char *optype_names[num_optypes] = {"reg", "imm", "label", "lit"};
+
+void usage() {
+	error("Usage: eepasm-gen configfile > gen_encoders.cpp");
+}
+
+std::string fn_name(const insdef_t& ins, size_t alt) {
+	return "enc_" + std::to_string(ins.index) + "_" + std::to_string(alt);
+}
+
+// encoder of alternative alt of ins
+std::string encoder_gen(const std::string& name, const insdef_t& ins, size_t alt_idx) {
+	const oplist_t& alt = ins.alts[alt_idx];
+	uint16_t start = ins.const_iword;
+	std::string desc, body;
+	for (size_t i = 0; i < alt.size(); i++) {
+		const operand_t& opd = alt[i];
+		desc += std::string {" "} + (opd.type == optype_t::lit ? opd.name : optype_names[static_cast<int>(opd.type)]);
+		if (opd.type == optype_t::lit) {
+			start += opd.lit_const;
+			continue;
+		}
+		// with the 2 operand shorthand the first operand is used twice
+		std::string tok_op = i == 0 ? "0" : std::to_string(i) + " - dup";
+		body += "\tiword += opd_encode<optype_t::" + std::string {optype_names[static_cast<int>(opd.type)]} + ", "
+			+ std::to_string(opd.lsb) + ", " + std::to_string(opd.mask) + ", " + std::to_string(opd.ins8)
+			+ ">(tokens, " + tok_op + ", alt[" + std::to_string(i) + "], pc, labels, unresolved);\n";
+	}
+
+	return "// " + name + desc + "\n"
+		+ "static uint16_t " + fn_name(ins, alt_idx) + "(const oplist_t& alt, const tokline_t& tokens, bool dup, int pc, "
+		+ "const symtab_t& labels, std::vector<unresolved_t> *unresolved) {\n"
+		+ "\tuint16_t iword = " + std::to_string(start) + ";\n" + body + "\treturn iword;\n}\n\n";
+}
+
+int main(int argc, char *argv[]) {
+	if (argc != 2)
+		usage();
+	std::string conf_file = argv[1];
+	insmap_t insmap = insmap_gen(conf_file);
+
+	std::vector<const std::pair<const std::string, insdef_t> *> order;
+	for (const auto& entry : insmap)
+		order.push_back(&entry);
+	std::sort(order.begin(), order.end(), [](auto a, auto b) { return a->second.index < b->second.index; });
+
+	std::string fns, tables, entries;
+	for (const auto *entry : order) {
+		const auto& [name, ins] = *entry;
+		std::string table = "enc_" + std::to_string(ins.index);
+		tables += "constexpr encode_fn_t " + table + "[] = {";
+		for (size_t alt = 0; alt < ins.alts.size(); alt++) {
+			fns += encoder_gen(name, ins, alt);
+			tables += (alt == 0 ? "" : ", ") + fn_name(ins, alt);
+		}
+		tables += "};\n";
+		entries += "\t{\"" + name + "\", " + std::to_string(insdef_hash(ins)) + "ULL, "
+			+ std::to_string(ins.alts.size()) + ", " + table + "},\n";
+	}
+
+	std::cout << "// generated by eepasm-gen from " << conf_file << ", do not edit\n"
+		<< "#include <string>\n#include <string_view>\n#include <vector>\n#include <unordered_map>\n"
+		<< "#include <stdexcept>\n#include <cstdint>\n\n"
+		<< "#include \"eepasm.h\"\n#include \"gen_encode.h\"\n\n"
+		<< fns << tables << "\n"
+		<< "const gen_ins_t gen_encoders[] = {\n" << entries << "};\n\n"
+		<< "const int num_gen_encoders = " << order.size() << ";\n";
+	return 0;
+}
@@ -0,0 +1,183 @@
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <iterator> // for istreambuf_iterator
+#include <stdexcept>
+#include <cstdint>
+
+#include "dis.h"
+
+constexpr int image_words = 1 << 16;
+
+void usage() {
+	error("Usage: eepdis [-c configfile] [-f format] [-a] image\n"
+		"       eepdis [-c configfile] [-f format] --roundtrip image\n"
+		"       eepdis [-c configfile] --trace file|-\n"
+		"formats: ram, raw, rawbe, ihex, sparse (default: detected from the content)\n"
+		"without -c the instruction list built into the binary is used");
+}
+
+char *put_addr(char *out, unsigned val) {
+	*out++ = '0';
+	*out++ = 'x';
+	return put_hex(out, val, 4);
+}
+
+// assembly source which assembles back to the image: org lines where the
+// addresses are not consecutive, words which encode no instruction as comments
+void disassemble(const disassembler& dis, const mem_image_t& image, bool annotate, std::string& out) {
+	int next_pc = 0;
+	for (int pc = 0; pc < image_words; pc++) {
+		if (!image.used[pc])
+			continue;
+		char buf[32];
+		uint16_t iword = image.words[pc];
+		std::string_view text = dis.text(iword);
+		if (text.empty()) {
+			out += "\t// invalid word ";
+			out.append(buf, put_addr(buf, iword) - buf);
+			out += " at ";
+			out.append(buf, put_addr(buf, pc) - buf);
+			out += '\n';
+			continue;
+		}
+		if (pc != next_pc) {
+			out += "org ";
+			out.append(buf, put_addr(buf, pc) - buf);
+			out += '\n';
+		}
+		out += '\t';
+		out += text;
+		if (annotate) {
+			out += "\t// ";
+			out.append(buf, put_addr(buf, pc) - buf);
+			out += ' ';
+			out.append(buf, put_addr(buf, iword) - buf);
+		}
+		out += '\n';
+		next_pc = pc + 1;
+	}
+}
+
+// reassembles the text of every word of image and reports words which
+// don't come out the same
+int roundtrip(const insmap_t& insmap, const disassembler& dis, const mem_image_t& image) {
+	const symtab_t no_labels;
+	long words = 0, invalid = 0, mismatches = 0;
+	for (int pc = 0; pc < image_words; pc++) {
+		if (!image.used[pc])
+			continue;
+		words++;
+		uint16_t iword = image.words[pc];
+		std::string_view text = dis.text(iword);
+		if (text.empty()) {
+			invalid++;
+			continue;
+		}
+		std::string msg;
+		try {
+			tokline_t tokens = scan_line(text, pc);
+			uint16_t again = encode_line(insmap, tokens, pc, no_labels);
+			char buf[8];
+			if (again != iword)
+				msg = "assembles to " + std::string(buf, put_addr(buf, again) - buf);
+		} catch (const assem_error& err) {
+			msg = err.what();
+		}
+		if (msg != "") {
+			std::cout << ins2str(pc, iword) << " '" << text << "': " << msg << "\n";
+			mismatches++;
+		}
+	}
+	std::cerr << words << " words, " << invalid << " invalid, " << mismatches << " round-trip mismatches\n";
+	return mismatches == 0 ? 0 : EXIT_FAILURE;
+}
+
+// appends the disassembly to every "0x<pc> 0x<word>" (or "0x<word>") line
+void trace(const disassembler& dis, std::string_view data, std::string& out) {
+	while (!data.empty()) {
+		size_t end = data.find('\n');
+		std::string_view line = data.substr(0, end);
+		data = end == std::string_view::npos ? std::string_view {} : data.substr(end + 1);
+		if (!line.empty() && line.back() == '\r')
+			line.remove_suffix(1);
+
+		out += line;
+		size_t word_start = line.find_last_of(" \t");
+		word_start = word_start == std::string_view::npos ? 0 : word_start + 1;
+		try {
+			std::string_view text = dis.text(num_parse(line.substr(word_start)));
+			out += '\t';
+			out += text.empty() ? "// invalid" : text;
+		} catch (const std::logic_error& err) {
+			// not an instruction word: copy unchanged
+		}
+		out += '\n';
+		if (out.size() > (1 << 20)) {
+			std::cout.write(out.data(), out.size());
+			out.clear();
+		}
+	}
+}
+
+int main(int argc, char *argv[]) {
+	std::string insfile = ""; // built-in ISA
+	std::string infile_name = "";
+	std::string fmt_name = "";
+	bool annotate = false;
+	bool check = false;
+	bool tracing = false;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--roundtrip") {
+			check = true;
+		} else if (arg == "--trace") {
+			tracing = true;
+		} else if (arg == "-a") {
+			annotate = true;
+		} else if ((arg == "-c" || arg == "-f") && i + 1 < argc) {
+			(arg == "-c" ? insfile : fmt_name) = argv[++i];
+		} else if (arg[0] == '-' && arg != "-") {
+			std::cerr << "Unrecognized option " << arg << std::endl;
+			usage();
+		} else {
+			infile_name = arg;
+		}
+	}
+	if (infile_name == "")
+		usage();
+
+	insmap_t insmap = isa_open(insfile);
+	disassembler dis {insmap};
+	std::ios::sync_with_stdio(false);
+	std::string out;
+
+	if (tracing) {
+		if (infile_name == "-") {
+			std::string data {std::istreambuf_iterator<char> {std::cin}, {}};
+			trace(dis, data, out);
+		} else {
+			file_map src {infile_name};
+			if (!src.is_open())
+				error("can't open trace file '" + infile_name + "'");
+			trace(dis, src.view(), out);
+		}
+		std::cout.write(out.data(), out.size());
+		return 0;
+	}
+
+	mem_image_t image;
+	try {
+		image = fmt_name == "" ? image_load(infile_name) : image_load(infile_name, outfmt_parse(fmt_name));
+	} catch (const assem_error& err) {
+		error(err.what());
+	}
+	if (check)
+		return roundtrip(insmap, dis, image);
+
+	disassemble(dis, image, annotate, out);
+	std::cout.write(out.data(), out.size());
+	return 0;
+}
@@ -0,0 +1,142 @@
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <utility> // for pair
+#include <algorithm> // for sort, max
+#include <stdexcept>
+#include <cstdint>
+
+#include "eepasm.h"
+
+// Linker for the relocatable objects of eepasm -r: the fixed sections stay
+// at their org address, the relocatable section of every object is placed,
+// in the order the objects are given, at the lowest address where it fits
+// around the fixed sections and the ones placed before. Then every label
+// operand left in the objects is filled in from the labels of all of them
+// and the words are written in any output format of eepasm.
+
+constexpr int mem_words = 1 << 16;
+
+void usage() {
+	error("Usage: eepld [-o outfile] [-f format] [--symbols symfile] objfile...\n"
+		"formats: ram, raw, rawbe, ihex, sparse");
+}
+
+// lowest address with len free words, used holds the occupied ranges
+int place(std::vector<std::pair<int, int>>& used, int len, const std::string& source) {
+	std::sort(used.begin(), used.end());
+	int addr = 0;
+	for (const auto& [begin, end] : used) {
+		if (addr + len <= begin)
+			break;
+		addr = std::max(addr, end);
+	}
+	if (addr + len > mem_words)
+		throw assem_error {source + ": no room for " + std::to_string(len) + " words"};
+	used.push_back({addr, addr + len});
+	return addr;
+}
+
+void link(const std::vector<object_t>& objs, out_writer& outfile, symtab_t& labels) {
+	std::vector<std::pair<int, int>> used;
+	for (const auto& obj : objs)
+		for (const auto& section : obj.sections)
+			if (section.fixed && !section.words.empty())
+				used.push_back({section.addr, section.addr + static_cast<int>(section.words.size())});
+	std::vector<int> base;
+	for (const auto& obj : objs)
+		base.push_back(obj.sections[0].words.empty() ? 0 : place(used, obj.sections[0].words.size(), obj.source));
+
+	auto section_addr = [&](size_t obj_idx, int section) {
+		const obj_section_t& sec = objs[obj_idx].sections[section];
+		return sec.fixed ? sec.addr : base[obj_idx];
+	};
+
+	std::vector<size_t> def_obj; // object defining every label of labels
+	for (size_t i = 0; i < objs.size(); i++) {
+		for (const auto& sym : objs[i].symbols) {
+			if (sym.section == sym_undef)
+				continue;
+			int addr = sym.section == sym_abs ? sym.value : section_addr(i, sym.section) + sym.value;
+			int id = labels.intern(sym.name);
+			if (labels.syms[id].value >= 0)
+				throw assem_error {objs[i].source + ": label '" + sym.name + "' already defined in "
+					+ objs[def_obj[id]].source + " on line " + std::to_string(labels.syms[id].line)};
+			labels.define(sym.name, addr, sym.line);
+			def_obj.resize(labels.syms.size());
+			def_obj[id] = i;
+		}
+	}
+
+	std::vector<std::vector<uint16_t>> words; // of every section of one object
+	for (size_t i = 0; i < objs.size(); i++) {
+		const object_t& obj = objs[i];
+		words.clear();
+		for (const auto& section : obj.sections)
+			words.push_back(section.words);
+		for (const auto& reloc : obj.relocs) {
+			const std::string& name = obj.symbols[reloc.symbol].name;
+			int value = labels.value(name);
+			if (value < 0)
+				throw assem_error {obj.source + ": label '" + name + "' not found in program"};
+			int pc = section_addr(i, reloc.section) + reloc.word;
+			int offset = label_offset(value, pc);
+			if (offset < -(1 << (reloc.size - 1)) || offset >= 1 << (reloc.size - 1))
+				throw assem_error {obj.source + ": label '" + name + "' out of reach (offset " + std::to_string(offset) + ") at address " + std::to_string(pc)};
+			words[reloc.section][reloc.word] += (offset & ((1 << reloc.size) - 1)) << reloc.lsb;
+		}
+		for (size_t s = 0; s < words.size(); s++) {
+			int addr = section_addr(i, s);
+			for (size_t w = 0; w < words[s].size(); w++)
+				outfile.put(addr + w, words[s][w]);
+		}
+	}
+}
+
+int main(int argc, char *argv[]) {
+	std::string outfile_name = "";
+	std::string sym_file = "";
+	outfmt_t fmt = outfmt_t::ram;
+	std::vector<std::string> obj_files;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if ((arg == "-o" || arg == "-f" || arg == "--symbols") && i + 1 < argc) {
+			std::string val = argv[++i];
+			try {
+				if (arg == "-f")
+					fmt = outfmt_parse(val);
+				else
+					(arg == "-o" ? outfile_name : sym_file) = val;
+			} catch (const assem_error& err) {
+				error(err.what());
+			}
+		} else if (arg[0] == '-') {
+			std::cerr << "Unrecognized option " << arg << std::endl;
+			usage();
+		} else {
+			obj_files.push_back(arg);
+		}
+	}
+	if (obj_files.empty())
+		usage();
+	if (outfile_name == "")
+		outfile_name = replace_ext(def_outfile, outfmt_ext(fmt));
+
+	try {
+		std::vector<object_t> objs;
+		for (const auto& path : obj_files)
+			objs.push_back(obj_load(path));
+		symtab_t labels;
+		out_writer outfile {outfile_name, fmt};
+		link(objs, outfile, labels);
+		outfile.close();
+		if (sym_file != "")
+			symtab_save(labels, sym_file);
+	} catch (const std::runtime_error& err) {
+		error(err.what());
+	}
+	return 0;
+}
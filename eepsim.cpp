@@ -0,0 +1,232 @@
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <chrono>
+#include <stdexcept>
+#include <cstdint>
+
+#include "sim.h"
+
+constexpr uint64_t def_max_steps = 1'000'000'000;
+
+// register (0-7), pc or data memory word set or checked by a test vector
+struct assign_t {
+	enum { reg, pc, mem } kind;
+	uint16_t idx; // register number or memory address
+	uint16_t val;
+};
+
+// one line of a test vector file: "R1=5 [0x20]=7 -> R2=12 [0x21]=3"
+struct vector_t {
+	int line;
+	std::vector<assign_t> init;
+	std::vector<assign_t> expect;
+};
+
+void usage() {
+	error("Usage: eepsim [-c configfile] [-f format] [-n maxsteps] image\n"
+		"       eepsim [-c configfile] [-f format] [-n maxsteps] -t vectorfile image\n"
+		"formats: ram, raw, rawbe, ihex, sparse (default: detected from the content)\n"
+		"without -c the instruction list built into the binary is used");
+}
+
+assign_t assign_parse(std::string_view tok) {
+	size_t eq = tok.find('=');
+	if (eq == std::string_view::npos)
+		throw assem_error {"missing '=' in '" + std::string {tok} + "'"};
+	std::string_view lhs = tok.substr(0, eq);
+	assign_t out;
+	try {
+		out.val = num_parse(tok.substr(eq + 1));
+		if (reg_check(lhs)) {
+			out.kind = assign_t::reg;
+			out.idx = reg_parse(lhs, operand_t {optype_t::reg, 0, regsize, (1 << regsize) - 1}, 0, {});
+		} else if (lhs.size() > 2 && lhs.front() == '[' && lhs.back() == ']') {
+			out.kind = assign_t::mem;
+			out.idx = num_parse(lhs.substr(1, lhs.size() - 2));
+		} else if (ci_eq(lhs, "pc")) {
+			out.kind = assign_t::pc;
+			out.idx = 0;
+		} else {
+			throw assem_error {"unknown location '" + std::string {lhs} + "'"};
+		}
+	} catch (const std::logic_error& err) {
+		throw assem_error {"invalid number in '" + std::string {tok} + "'"};
+	}
+	return out;
+}
+
+std::vector<vector_t> vectors_load(const std::string& path) {
+	file_map src {path};
+	if (!src.is_open())
+		error("can't open test vector file '" + path + "'");
+
+	std::vector<vector_t> out;
+	std::string_view data = src.view();
+	int line_no = 0;
+	while (!data.empty()) {
+		size_t end = data.find('\n');
+		std::string_view line = data.substr(0, end);
+		data = end == std::string_view::npos ? std::string_view {} : data.substr(end + 1);
+		line_no++;
+		line = line.substr(0, line.find("//"));
+
+		vector_t vec {line_no};
+		bool expect = false;
+		size_t pos = 0;
+		while ((pos = line.find_first_not_of(" \t\r", pos)) != std::string_view::npos) {
+			size_t tok_end = line.find_first_of(" \t\r", pos);
+			std::string_view tok = line.substr(pos, tok_end - pos);
+			pos = tok_end;
+			if (tok == "->") {
+				expect = true;
+				continue;
+			}
+			try {
+				(expect ? vec.expect : vec.init).push_back(assign_parse(tok));
+			} catch (const assem_error& err) {
+				error(path + ":" + std::to_string(line_no) + ": " + err.what());
+			}
+		}
+		if (!vec.init.empty() || !vec.expect.empty() || expect)
+			out.push_back(vec);
+	}
+	return out;
+}
+
+std::string hex16(uint16_t val) {
+	char buf[8] = {'0', 'x'};
+	return std::string(buf, put_hex(buf + 2, val, 4));
+}
+
+std::string assign_name(const assign_t& a) {
+	switch (a.kind) {
+	case assign_t::reg:
+		return "R" + std::to_string(a.idx);
+	case assign_t::pc:
+		return "PC";
+	case assign_t::mem:
+		return "[" + hex16(a.idx) + "]";
+	}
+	return "";
+}
+
+uint16_t& assign_ref(sim_state_t& state, const assign_t& a) {
+	switch (a.kind) {
+	case assign_t::reg:
+		return state.reg[a.idx];
+	case assign_t::pc:
+		return state.pc;
+	default:
+		return state.mem[a.idx];
+	}
+}
+
+std::string state_str(const sim_state_t& state) {
+	std::string out;
+	for (int i = 0; i < 8; i++)
+		out += "R" + std::to_string(i) + "=" + hex16(state.reg[i]) + " ";
+	out += "PC=" + hex16(state.pc) + " NZCV=";
+	for (bool flag : {state.n, state.z, state.c, state.v})
+		out += flag ? '1' : '0';
+	return out;
+}
+
+bool stop_ok(sim_stop_t stop) {
+	return stop == sim_stop_t::halt || stop == sim_stop_t::end;
+}
+
+int run_vectors(const simulator& sim, const std::vector<vector_t>& vectors, uint64_t max_steps) {
+	sim_state_t state;
+	int failed = 0;
+	uint64_t steps = 0;
+	auto start = std::chrono::steady_clock::now();
+
+	for (const auto& vec : vectors) {
+		state.reset();
+		for (const auto& a : vec.init)
+			assign_ref(state, a) = a.val;
+		sim_stop_t stop = sim.run(state, max_steps);
+		steps += state.steps;
+
+		std::string msg;
+		if (!stop_ok(stop))
+			msg = sim_stop_name(stop) + " at " + hex16(state.pc);
+		for (const auto& a : vec.expect) {
+			uint16_t got = assign_ref(state, a);
+			if (got != a.val)
+				msg += (msg == "" ? "" : ", ") + assign_name(a) + "=" + hex16(got) + " expected " + hex16(a.val);
+		}
+		if (msg != "") {
+			std::cout << "line " << vec.line << ": FAIL: " << msg << "\n";
+			failed++;
+		} else if (vec.expect.empty()) {
+			std::cout << "line " << vec.line << ": " << state_str(state) << "\n";
+		}
+	}
+
+	double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::cerr << vectors.size() << " vectors, " << vectors.size() - failed << " passed, " << failed << " failed; "
+		<< steps << " instructions in " << secs << " s (" << (secs > 0 ? steps / secs / 1e6 : 0) << " MIPS)\n";
+	return failed == 0 ? 0 : EXIT_FAILURE;
+}
+
+int main(int argc, char *argv[]) {
+	std::string insfile = ""; // built-in ISA
+	std::string image_name = "";
+	std::string vector_file = "";
+	std::string fmt_name = "";
+	uint64_t max_steps = def_max_steps;
+
+	for (int i = 1; i < argc; i++) {
+		if (argv[i][0] == '-' && argv[i][1] != '\0' && argv[i][2] == '\0' && i + 1 < argc) {
+			switch (argv[i][1]) {
+			case 'c':
+				insfile = argv[++i];
+				break;
+			case 'f':
+				fmt_name = argv[++i];
+				break;
+			case 'n':
+				try {
+					max_steps = std::stoull(argv[++i]);
+				} catch (const std::logic_error& err) {
+					usage();
+				}
+				break;
+			case 't':
+				vector_file = argv[++i];
+				break;
+			default:
+				std::cerr << "Unrecognized option " << argv[i] << std::endl;
+				usage();
+			}
+		} else if (argv[i][0] == '-') {
+			std::cerr << "Unrecognized option " << argv[i] << std::endl;
+			usage();
+		} else {
+			image_name = argv[i];
+		}
+	}
+	if (image_name == "")
+		usage();
+
+	insmap_t insmap = isa_open(insfile);
+	mem_image_t image;
+	try {
+		image = fmt_name == "" ? image_load(image_name) : image_load(image_name, outfmt_parse(fmt_name));
+	} catch (const assem_error& err) {
+		error(err.what());
+	}
+	simulator sim {insmap, image};
+
+	if (vector_file != "")
+		return run_vectors(sim, vectors_load(vector_file), max_steps);
+
+	sim_state_t state;
+	sim_stop_t stop = sim.run(state, max_steps);
+	std::cout << sim_stop_name(stop) << " at " << hex16(state.pc) << " after " << state.steps << " steps\n"
+		<< state_str(state) << "\n";
+	return stop_ok(stop) ? 0 : EXIT_FAILURE;
+}
@@ -0,0 +1,99 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm> // for sort, find_if
+#include <stdexcept>
+#include <cstdint>
+
+#include "eepasm.h"
+
+// Build tool: writes the instruction definitions of a config file as
+// constant tables (builtin_isa.h) which builtin.cpp compiles into the tools
+
+void usage() {
+	error("Usage: embed_isa configfile > builtin_isa.h");
+}
+
+int main(int argc, char *argv[]) {
+	if (argc != 2)
+		usage();
+	std::string conf_file = argv[1];
+	file_map src {conf_file};
+	if (!src.is_open())
+		error("Can't open instruction list config file '" + conf_file + "'");
+	insmap_t insmap = insmap_gen(conf_file);
+
+	std::vector<const std::pair<const std::string, insdef_t> *> order;
+	for (const auto& entry : insmap)
+		order.push_back(&entry);
+	std::sort(order.begin(), order.end(), [](auto a, auto b) { return a->second.index < b->second.index; });
+
+	std::string opds, alts, lits, lit_ids, matches, longs, ins;
+	int nopds = 0, nalts = 0, nlits = 0, nmatches = 0, nlongs = 0;
+	std::vector<std::string> lit_names; // distinct over all instructions (any case)
+	for (const auto *entry : order) {
+		const auto& [name, def] = *entry;
+		ins += "\t{\"" + name + "\", " + std::to_string(def.const_iword) + ", "
+			+ std::to_string(nalts) + ", " + std::to_string(def.alts.size()) + ", "
+			+ std::to_string(nlits) + ", " + std::to_string(def.lit_names.size()) + ", "
+			+ std::to_string(def.nclasses) + ", " + std::to_string(nmatches) + ", "
+			+ std::to_string(def.match_table.size()) + ", " + std::to_string(nlongs) + ", "
+			+ std::to_string(def.long_form.size()) + "},\n";
+		for (const auto& line : def.long_form) {
+			longs += "\t\"";
+			for (char c : line)
+				longs += c == '"' || c == '\\' ? std::string {'\\', c} : std::string {c};
+			longs += "\",\n";
+		}
+		nlongs += def.long_form.size();
+		for (const auto& lit_name : def.lit_names) {
+			lits += "\t\"" + lit_name + "\",\n";
+			auto same = std::find_if(lit_names.begin(), lit_names.end(), [&](const std::string& other) { return ci_eq(other, lit_name); });
+			if (same == lit_names.end())
+				same = lit_names.insert(same, lit_name);
+			lit_ids += "\t" + std::to_string(same - lit_names.begin()) + ",\n";
+		}
+		nlits += def.lit_names.size();
+		for (const auto& match : def.match_table)
+			matches += "\t{" + std::to_string(match.alt) + ", " + std::to_string(match.dup) + "},\n";
+		nmatches += def.match_table.size();
+		for (const auto& alt : def.alts) {
+			alts += "\t{" + std::to_string(nopds) + ", " + std::to_string(alt.size()) + "},\n";
+			nalts++;
+			for (const auto& opd : alt) {
+				opds += "\t{" + std::to_string(static_cast<int>(opd.type)) + ", " + std::to_string(opd.lsb) + ", "
+					+ std::to_string(opd.size) + ", " + std::to_string(opd.mask) + ", " + std::to_string(opd.ins8)
+					+ ", " + std::to_string(opd.lit_const) + ", \"" + opd.name + "\"},\n";
+				nopds++;
+			}
+		}
+	}
+
+	std::string names;
+	for (const auto& lit_name : lit_names)
+		names += "\t\"" + lit_name + "\",\n";
+
+	std::cout << "// generated by embed_isa from " << conf_file << ", do not edit\n"
+		<< "#ifndef BUILTIN_ISA_H\n#define BUILTIN_ISA_H\n\n"
+		<< "#include <cstdint>\n\n"
+		<< "struct builtin_opd_t {\n\tuint8_t type, lsb, size;\n\tuint16_t mask, ins8, lit_const;\n\tconst char *name;\n};\n\n"
+		<< "struct builtin_alt_t {\n\tuint16_t first_opd, nopds;\n};\n\n"
+		<< "struct builtin_match_t {\n\tint8_t alt;\n\tbool dup;\n};\n\n"
+		<< "// in config order\n"
+		<< "struct builtin_ins_t {\n\tconst char *name;\n\tuint16_t const_iword, first_alt, nalts, first_lit, nlits, nclasses;\n"
+		<< "\tuint32_t first_match, nmatches;\n\tuint16_t first_long, nlongs;\n};\n\n"
+		<< "constexpr uint64_t builtin_src_hash = " << fnv1a_hash(src.data(), src.size()) << "ULL;\n\n"
+		<< "constexpr builtin_opd_t builtin_opds[] = {\n" << opds << "};\n\n"
+		<< "constexpr builtin_alt_t builtin_alts[] = {\n" << alts << "};\n\n"
+		<< "constexpr const char *builtin_lits[] = {\n" << lits << "\tnullptr // never empty\n};\n\n"
+		<< "// index in builtin_lit_names of every entry of builtin_lits\n"
+		<< "constexpr int8_t builtin_lit_ids[] = {\n" << lit_ids << "\t-1 // never empty\n};\n\n"
+		<< "constexpr const char *builtin_lit_names[] = {\n" << names << "\tnullptr // never empty\n};\n\n"
+		<< "constexpr builtin_match_t builtin_matches[] = {\n" << matches << "};\n\n"
+		<< "constexpr const char *builtin_longs[] = {\n" << longs << "\tnullptr // never empty\n};\n\n"
+		<< "constexpr builtin_ins_t builtin_ins[] = {\n" << ins << "};\n\n"
+		<< "#endif\n";
+	return 0;
+}
@@ -0,0 +1,47 @@
+#ifndef GEN_ENCODE_H
+#define GEN_ENCODE_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <stdexcept>
+#include <cstdint>
+
+#include "eepasm.h"
+
+// Operand encoders with the field layout as template arguments, used by the
+// encoders eepasm-gen writes (gen_encoders.cpp). They give the same words
+// and errors as the optype_fns of encode_line. lit operands don't appear:
+// their constant is folded into the start value of the word.
+
+template <optype_t type, uint8_t lsb, uint16_t mask, uint16_t ins8>
+inline uint16_t opd_encode(const tokline_t& tokens, int tok_op, const operand_t& opd, int pc, const symtab_t& labels, std::vector<unresolved_t> *unresolved) {
+	static_assert(type != optype_t::lit, "lit operands are constant");
+	std::string_view op = tokens.op(tok_op);
+	if constexpr (type == optype_t::reg) {
+		return reg_num(op) << lsb;
+	} else if constexpr (type == optype_t::imm) {
+		return static_cast<uint16_t>((num_parse(op) & mask) << lsb) + ins8;
+	} else {
+		int value = label_value(tokens, tok_op, labels);
+		if (value < 0 && unresolved) {
+			unresolved->push_back({op, &opd});
+			return 0;
+		}
+		return label_encode(op, value, pc);
+	}
+}
+
+// encoders of one instruction as written by eepasm-gen
+struct gen_ins_t {
+	const char *name;
+	uint64_t hash; // insdef_hash of the definition they were generated from
+	int nalts;
+	const encode_fn_t *fns;
+};
+
+extern const gen_ins_t gen_encoders[];
+extern const int num_gen_encoders;
+
+#endif
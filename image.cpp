@@ -0,0 +1,167 @@
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <stdexcept>
+#include <cstdint>
+
+#include "eepasm.h"
+
+// Reading assembled programs back from the output formats (see output.cpp)
+
+constexpr int image_words = 1 << 16;
+
+outfmt_t image_detect(std::string_view data) {
+	if (data.substr(0, 4) == "EEPS")
+		return outfmt_t::sparse;
+	size_t start = data.find_first_not_of(" \t\r\n");
+	if (start != std::string_view::npos && data[start] == ':')
+		return outfmt_t::ihex;
+	if (start != std::string_view::npos && data.substr(start, 2) == "0x")
+		return outfmt_t::ram;
+	return outfmt_t::raw_le;
+}
+
+void image_put(mem_image_t& image, unsigned addr, uint16_t word) {
+	if (addr >= image_words)
+		throw assem_error {"address " + std::to_string(addr) + " out of range"};
+	image.words[addr] = word;
+	image.used[addr] = true;
+}
+
+unsigned hex_get(std::string_view data, size_t pos, int digits) {
+	if (pos + digits > data.size())
+		throw assem_error {"truncated Intel HEX record"};
+	unsigned val = 0;
+	for (int i = 0; i < digits; i++) {
+		char c = data[pos + i];
+		int digit = (c >= '0' && c <= '9') ? c - '0' : ((c | 0x20) >= 'a' && (c | 0x20) <= 'f') ? (c | 0x20) - 'a' + 10 : -1;
+		if (digit < 0)
+			throw assem_error {"invalid hex digit in Intel HEX record"};
+		val = (val << 4) | digit;
+	}
+	return val;
+}
+
+void ram_parse(std::string_view data, mem_image_t& image) {
+	int line_no = 0;
+	while (!data.empty()) {
+		size_t end = data.find('\n');
+		std::string_view line = data.substr(0, end);
+		data = end == std::string_view::npos ? std::string_view {} : data.substr(end + 1);
+		line_no++;
+
+		size_t space = line.find(' ');
+		if (line.find_first_not_of(" \t\r") == std::string_view::npos)
+			continue;
+		try {
+			if (space == std::string_view::npos)
+				throw std::invalid_argument {"missing word"};
+			unsigned addr = std::stoul(std::string {line.substr(0, space)}, nullptr, 0);
+			image_put(image, addr, std::stoul(std::string {line.substr(space + 1)}, nullptr, 0));
+		} catch (const std::logic_error& err) {
+			throw assem_error {"line " + std::to_string(line_no) + ": invalid .ram line"};
+		}
+	}
+}
+
+void raw_parse(std::string_view data, mem_image_t& image, bool big_endian) {
+	if (data.size() % 2 || data.size() / 2 > image_words)
+		throw assem_error {"raw image must have an even size of at most 128KiB"};
+	for (size_t i = 0; i < data.size() / 2; i++) {
+		uint8_t lo = data[2 * i + (big_endian ? 1 : 0)];
+		uint8_t hi = data[2 * i + (big_endian ? 0 : 1)];
+		image_put(image, i, lo | hi << 8);
+	}
+}
+
+// data records are taken as little endian words at byte address 2 * pc
+void ihex_parse(std::string_view data, mem_image_t& image) {
+	unsigned upper = 0;
+	size_t pos = 0;
+	while ((pos = data.find(':', pos)) != std::string_view::npos) {
+		pos++;
+		unsigned len = hex_get(data, pos, 2);
+		unsigned addr = hex_get(data, pos + 2, 4);
+		unsigned type = hex_get(data, pos + 6, 2);
+		uint8_t sum = len + (addr >> 8) + addr + type;
+		std::vector<uint8_t> bytes(len);
+		for (unsigned i = 0; i < len; i++)
+			sum += bytes[i] = hex_get(data, pos + 8 + 2 * i, 2);
+		sum += hex_get(data, pos + 8 + 2 * len, 2);
+		if (sum != 0)
+			throw assem_error {"Intel HEX checksum mismatch"};
+		pos += 10 + 2 * len;
+
+		if (type == 1)
+			break;
+		if (type == 4 && len == 2) {
+			upper = bytes[0] << 8 | bytes[1];
+		} else if (type == 0) {
+			unsigned byte_addr = (upper << 16) + addr;
+			if (byte_addr % 2 || len % 2)
+				throw assem_error {"Intel HEX record not aligned to words"};
+			for (unsigned i = 0; i < len; i += 2)
+				image_put(image, (byte_addr + i) / 2, bytes[i] | bytes[i + 1] << 8);
+		}
+	}
+}
+
+void sparse_parse(std::string_view data, mem_image_t& image) {
+	size_t pos = 4;
+	auto get_u32 = [&]() {
+		if (pos + 4 > data.size())
+			throw assem_error {"truncated sparse image"};
+		const uint8_t *p = reinterpret_cast<const uint8_t *>(data.data() + pos);
+		pos += 4;
+		return static_cast<uint32_t>(p[0] | p[1] << 8 | p[2] << 16 | static_cast<uint32_t>(p[3]) << 24);
+	};
+	uint32_t nsegments = get_u32();
+	for (uint32_t s = 0; s < nsegments; s++) {
+		uint32_t start = get_u32();
+		uint32_t len = get_u32();
+		if (len > image_words || pos + 2 * static_cast<size_t>(len) > data.size())
+			throw assem_error {"truncated sparse image"};
+		for (uint32_t i = 0; i < len; i++, pos += 2)
+			image_put(image, start + i, static_cast<uint8_t>(data[pos]) | static_cast<uint8_t>(data[pos + 1]) << 8);
+	}
+}
+
+mem_image_t image_parse(std::string_view data, outfmt_t fmt) {
+	mem_image_t image {std::vector<uint16_t>(image_words), std::vector<bool>(image_words)};
+	switch (fmt) {
+	case outfmt_t::ram:
+		ram_parse(data, image);
+		break;
+	case outfmt_t::raw_le:
+	case outfmt_t::raw_be:
+		raw_parse(data, image, fmt == outfmt_t::raw_be);
+		break;
+	case outfmt_t::ihex:
+		ihex_parse(data, image);
+		break;
+	case outfmt_t::sparse:
+		sparse_parse(data, image);
+		break;
+	}
+	return image;
+}
+
+mem_image_t image_load(const std::string& path, outfmt_t fmt) {
+	file_map src {path};
+	if (!src.is_open())
+		throw assem_error {"can't open image file '" + path + "'"};
+	try {
+		return image_parse(src.view(), fmt);
+	} catch (const assem_error& err) {
+		throw assem_error {"image file '" + path + "': " + err.what()};
+	}
+}
+
+// format guessed from the content
+mem_image_t image_load(const std::string& path) {
+	file_map src {path};
+	if (!src.is_open())
+		throw assem_error {"can't open image file '" + path + "'"};
+	return image_load(path, image_detect(src.view()));
+}
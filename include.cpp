@@ -0,0 +1,202 @@
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <map>
+#include <memory> // for shared_ptr
+#include <mutex>
+#include <utility> // for pair
+#include <algorithm> // for find, any_of
+#include <iterator> // for prev
+#include <stdexcept>
+#include <cstdint>
+#include <cstdlib> // for realpath, free
+
+#include <sys/stat.h> // for stat
+
+#include "eepasm.h"
+#include "module_cache.h"
+
+// include "file": every included file is lexed once per content (by hash)
+// into a module of the module cache of its ISA: its token records, include
+// lines among them, and its labels by the index of the record they precede,
+// i.e. relative to the include point. Linking a source copies the records of
+// its modules in place of the include lines, from any source of a batch or
+// any job of a server, and defines their labels at the pc reached there.
+// The records point into the text of the module, so every job keeps the
+// modules it linked (module_refs_t).
+
+namespace {
+
+std::string real_path(const std::string& path) {
+	char *abs_path = realpath(path.c_str(), nullptr);
+	std::string out = abs_path ? abs_path : path;
+	std::free(abs_path);
+	return out;
+}
+
+}
+
+bool is_include(const tokline_t& tokens) {
+	return ci_eq(tokens.tok(0), "include");
+}
+
+// file named by an include line, relative to the directory of src_path
+std::string include_path(const tokline_t& tokens, const std::string& src_path) {
+	int ntok = std::min<int>(tokens.ntok, max_line_toks);
+	if (tokens.nops() < 1 || ntok < tokens.ntok)
+		throw source_error {tokens, "expected include \"file\""};
+	// the name may contain separators: it spans all operand tokens
+	const char *begin = tokens.text + tokens.tokens[1].off;
+	const char *end = tokens.text + tokens.tokens[ntok - 1].off + tokens.tokens[ntok - 1].len;
+	if (end - begin < 3 || *begin != '"' || end[-1] != '"')
+		throw source_error {tokens, "expected include \"file\""};
+	std::string name {begin + 1, end - 1};
+
+	size_t slash = src_path.rfind('/');
+	if (name[0] == '/' || slash == std::string::npos)
+		return name;
+	return src_path.substr(0, slash + 1) + name;
+}
+
+std::shared_ptr<const module_t> module_cache_t::get(const std::string& path, const insmap_t& insmap, asm_stats_t *stats) {
+	struct stat st;
+	if (stat(path.c_str(), &st) != 0)
+		throw assem_error {"can't open include file '" + path + "'"};
+	std::string real = real_path(path);
+	int64_t mtime_ns = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+	{
+		std::lock_guard<std::mutex> guard {lock};
+		auto file_it = files.find(real);
+		if (file_it != files.end() && file_it->second.mtime_ns == mtime_ns && file_it->second.size == st.st_size)
+			return modules.at(file_it->second.hash);
+	}
+
+	file_map src {path};
+	if (!src.is_open())
+		throw assem_error {"can't open include file '" + path + "'"};
+	uint64_t hash = fnv1a_hash(src.data(), src.size());
+	std::shared_ptr<const module_t> mod;
+	{
+		std::lock_guard<std::mutex> guard {lock};
+		auto mod_it = modules.find(hash);
+		if (mod_it != modules.end())
+			mod = mod_it->second;
+	}
+	if (!mod) {
+		// lexed without the lock: another thread may add the same module
+		// meanwhile, then that one is kept
+		auto lexed = std::make_shared<module_t>();
+		lexed->path = path;
+		lexed->text.assign(src.data(), src.size());
+		try {
+			file_lex(lexed->text, insmap, *lexed, &lexed->stats);
+		} catch (const source_error& err) {
+			throw assem_error {path + ": " + err.what()};
+		}
+		if (stats) {
+			stats->map_lookups += lexed->stats.map_lookups;
+			stats->hash_probes += lexed->stats.hash_probes;
+		}
+		mod = std::move(lexed);
+	}
+
+	std::lock_guard<std::mutex> guard {lock};
+	mod = modules.try_emplace(hash, mod).first->second;
+	auto [file_it, added] = files.try_emplace(real, file_t {hash, mtime_ns, st.st_size});
+	if (!added) {
+		uint64_t old_hash = file_it->second.hash;
+		file_it->second = {hash, mtime_ns, st.st_size};
+		if (old_hash != hash && std::none_of(files.begin(), files.end(), [&](const auto& file) { return file.second.hash == old_hash; }))
+			modules.erase(old_hash);
+	}
+	return mod;
+}
+
+// module of the file at path (see module_cache_t::get), kept for this job;
+// the lookups of lexing it are counted in stats if it wasn't in the cache
+const module_t& module_refs_t::get(const std::string& path, const insmap_t& insmap, asm_stats_t *stats) {
+	std::shared_ptr<const module_t> mod = cache.get(path, insmap, stats);
+	const module_t& out = *mod;
+	used.try_emplace(out.text.data(), std::move(mod));
+	return out;
+}
+
+std::string module_refs_t::file_of(const char *text) const {
+	auto it = used.upper_bound(text);
+	if (it == used.begin())
+		return "";
+	const module_t& mod = *std::prev(it)->second;
+	return text < mod.text.data() + mod.text.size() ? mod.path : "";
+}
+
+source_error module_refs_t::locate(const source_error& err) const {
+	std::string file = err.file.empty() && err.text ? file_of(err.text) : "";
+	return file.empty() ? err : source_error {err, file};
+}
+
+// append the records of mod (included as path) to ln.out with its includes
+// linked in their place, and define its labels at the pc of their record.
+// The labels of the main source are already in ln.labels with the record
+// index as value, the ones of included modules are interned there. The
+// lines, tokens and labels of an included module count at every include.
+void module_link(const module_t& mod, const std::string& path, bool main, const insmap_t& insmap, link_state_t& ln) {
+	if (main && !path.empty())
+		ln.open_files.push_back(real_path(path));
+	std::vector<int> remap; // module symbol id to id in ln.labels
+	if (!main)
+		for (const auto& sym : mod.labels.syms)
+			remap.push_back(ln.labels.intern(sym.name));
+	if (!main && ln.stats) {
+		ln.stats->lines += mod.stats.lines;
+		ln.stats->tokens += mod.stats.tokens;
+		ln.stats->labels += mod.stats.labels;
+		ln.stats->map_lookups += remap.size() + mod.defs.size(); // interned and defined here
+	}
+	size_t next_def = 0;
+	auto define_upto = [&](size_t idx) {
+		for (; next_def < mod.defs.size(); next_def++) {
+			int id = mod.defs[next_def];
+			const symbol_t& local = main ? ln.labels.syms[id] : mod.labels.syms[id];
+			if (static_cast<size_t>(local.value) > idx)
+				break;
+			symbol_t& sym = main ? ln.labels.syms[id] : ln.labels.syms[ln.labels.define(local.name, ln.pc, local.line)];
+			sym.value = ln.pc;
+			sym.absolute = ln.org_seen;
+			sym.index = ln.out.size();
+		}
+	};
+
+	for (size_t i = 0; i < mod.tok_vec.size(); i++) {
+		define_upto(i);
+		tokline_t tokens = mod.tok_vec[i];
+		if (is_include(tokens)) {
+			std::string inc_path = include_path(tokens, path);
+			try {
+				const module_t& inc = ln.modules->get(inc_path, insmap, ln.stats);
+				std::string real = real_path(inc_path);
+				if (std::find(ln.open_files.begin(), ln.open_files.end(), real) != ln.open_files.end())
+					throw assem_error {"'" + inc_path + "' includes itself"};
+				ln.open_files.push_back(real);
+				module_link(inc, inc_path, false, insmap, ln);
+				ln.open_files.pop_back();
+			} catch (const assem_error& err) {
+				throw source_error {tokens, err.what()};
+			}
+			ln.region_start = true;
+			continue;
+		}
+		if (is_org(tokens)) {
+			ln.pc = org_parse(tokens);
+			ln.org_seen = true;
+		} else {
+			if (!main && tokens.label_op >= 0)
+				tokens.label_sym = remap[tokens.label_sym];
+			ln.pc++;
+		}
+		tokens.region_start |= ln.region_start;
+		ln.region_start = false;
+		ln.out.push_back(tokens);
+	}
+	define_upto(mod.tok_vec.size());
+}
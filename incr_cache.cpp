@@ -0,0 +1,202 @@
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <stdexcept>
+#include <cstdint>
+#include <algorithm> // for min
+#include <cstdlib> // for realpath, free
+
+#include <sys/stat.h> // for mkdir
+
+#include "eepasm.h"
+#include "bin_io.h"
+
+// Incremental reassembly: the program is split into regions which start at
+// every label definition and org line. A region is cached under the hash of
+// its tokens (and the ISA hash) with its words encoded without labels plus
+// the label references inside it. On the next run unchanged regions reuse the
+// cached words and only their label offsets are resolved again, so regions
+// don't need to be re-encoded when labels move.
+//
+// cache file (one per input file, host byte order):
+//   "EEPI", version (u32), ISA hash (u64), number of regions (u32)
+//   per region: token hash (u64), number of words (u32), words (u16 each),
+//               number of label references (u32), then for every reference:
+//               index of word in region (u32), label (u16 length + bytes)
+
+constexpr char incr_magic[4] = {'E', 'E', 'P', 'I'};
+constexpr uint32_t incr_version = 1;
+
+struct label_ref_t {
+	uint32_t word; // index of word in region
+	std::string label;
+};
+
+struct region_t {
+	std::vector<uint16_t> words; // encoded without label offsets
+	std::vector<label_ref_t> refs;
+};
+
+using regionmap_t = std::unordered_map<uint64_t, region_t>;
+
+std::string incr_cache_path(const std::string& infile_name, const std::string& cache_dir) {
+	char *abs_path = realpath(infile_name.c_str(), nullptr);
+	std::string path = abs_path ? abs_path : infile_name;
+	std::free(abs_path);
+
+	char name[17];
+	*put_hex(name, fnv1a_hash(path.data(), path.size()) >> 32, 8) = '\0';
+	std::string out = cache_dir + "/" + name;
+	*put_hex(name, fnv1a_hash(path.data(), path.size()) & 0xffffffff, 8) = '\0';
+	return out + name + ".eepi";
+}
+
+regionmap_t incr_load(const std::string& cache_file, uint64_t isa_hash) {
+	regionmap_t regions;
+	file_map cache {cache_file};
+	if (!cache.is_open())
+		return regions;
+	try {
+		bin_reader in {cache.data(), cache.size()};
+		for (char c : incr_magic)
+			if (in.get<char>() != c)
+				return regions;
+		if (in.get<uint32_t>() != incr_version || in.get<uint64_t>() != isa_hash)
+			return regions;
+		uint32_t nregions = in.get<uint32_t>();
+		for (uint32_t i = 0; i < nregions; i++) {
+			region_t& region = regions[in.get<uint64_t>()];
+			region.words.resize(in.get<uint32_t>());
+			for (auto& word : region.words)
+				word = in.get<uint16_t>();
+			region.refs.resize(in.get<uint32_t>());
+			for (auto& ref : region.refs) {
+				ref.word = in.get<uint32_t>();
+				ref.label = in.get_str<uint16_t>();
+				if (ref.word >= region.words.size())
+					throw parsing_error {"invalid label reference"};
+			}
+		}
+	} catch (const parsing_error& err) {
+		// corrupt cache: start from scratch
+		regions.clear();
+	}
+	return regions;
+}
+
+void incr_store(const std::string& cache_file, uint64_t isa_hash, const regionmap_t& regions) {
+	std::string buf;
+	buf.append(incr_magic, sizeof(incr_magic));
+	put<uint32_t>(buf, incr_version);
+	put<uint64_t>(buf, isa_hash);
+	put<uint32_t>(buf, regions.size());
+	for (const auto& [hash, region] : regions) {
+		put<uint64_t>(buf, hash);
+		put<uint32_t>(buf, region.words.size());
+		for (uint16_t word : region.words)
+			put<uint16_t>(buf, word);
+		put<uint32_t>(buf, region.refs.size());
+		for (const auto& ref : region.refs) {
+			put<uint32_t>(buf, ref.word);
+			put_str<uint16_t>(buf, ref.label);
+		}
+	}
+	write_file_atomic(cache_file, buf); // cache is best effort only
+}
+
+uint64_t region_hash(const tokvec_t& tok_vec, size_t begin, size_t end, uint64_t isa_hash) {
+	uint64_t hash = fnv1a_hash(reinterpret_cast<const char *>(&isa_hash), sizeof(isa_hash));
+	for (size_t i = begin; i < end; i++) {
+		int ntok = std::min<int>(tok_vec[i].ntok, max_line_toks);
+		for (int t = 0; t < ntok; t++) {
+			std::string_view tok = tok_vec[i].tok(t);
+			hash = fnv1a_hash(tok.data(), tok.size(), hash);
+			hash = fnv1a_hash(" ", 1, hash);
+		}
+		hash = fnv1a_hash("\n", 1, hash);
+	}
+	return hash;
+}
+
+void encode_cached(const insmap_t& insmap, const tokvec_t& tok_vec, const symtab_t& label_map, out_writer& outfile, const std::string& infile_name, const asm_opts_t& opts) {
+	mkdir(opts.cache_dir.c_str(), 0777); // may exist already
+	std::string cache_file = incr_cache_path(infile_name, opts.cache_dir);
+	regionmap_t old_regions = incr_load(cache_file, opts.isa_hash);
+	regionmap_t new_regions;
+
+	const symtab_t no_labels;
+	const operand_t label_opd {optype_t::label, 0, offset_size, (1 << offset_size) - 1};
+	std::vector<unresolved_t> unresolved;
+	std::vector<size_t> word_lines; // index in tok_vec of every word in region
+	long reused = 0, encoded = 0;
+
+	int pc = 0;
+	size_t begin = 0;
+	while (begin < tok_vec.size()) {
+		size_t end = begin + 1;
+		while (end < tok_vec.size() && !tok_vec[end].region_start)
+			end++;
+
+		word_lines.clear();
+		for (size_t i = begin; i < end; i++)
+			if (!is_org(tok_vec[i]))
+				word_lines.push_back(i);
+
+		// a region repeating one before it (same tokens) is already in
+		// new_regions, whether it came from the cache or was encoded
+		uint64_t hash = region_hash(tok_vec, begin, end, opts.isa_hash);
+		auto new_it = new_regions.find(hash);
+		auto old_it = new_it == new_regions.end() ? old_regions.find(hash) : old_regions.end();
+		region_t *region;
+		if (new_it != new_regions.end() && new_it->second.words.size() == word_lines.size()) {
+			region = &new_it->second;
+			reused += word_lines.size();
+		} else if (old_it != old_regions.end() && old_it->second.words.size() == word_lines.size()) {
+			region = &(new_regions[hash] = std::move(old_it->second));
+			old_regions.erase(old_it);
+			reused += word_lines.size();
+		} else {
+			region = &new_regions[hash];
+			region->words.clear();
+			region->refs.clear();
+			for (size_t i : word_lines) {
+				// cached words don't depend on labels: every label is unresolved
+				tokline_t tokens = tok_vec[i];
+				tokens.label_op = -1;
+				unresolved.clear();
+				region->words.push_back(encode_line(insmap, tokens, pc, no_labels, &unresolved, opts.stats));
+				for (const auto& ref : unresolved)
+					region->refs.push_back({static_cast<uint32_t>(region->words.size() - 1), std::string {ref.label}});
+			}
+			encoded += word_lines.size();
+		}
+
+		// resolve labels and write region
+		size_t ref_idx = 0;
+		size_t word_idx = 0;
+		for (size_t i = begin; i < end; i++) {
+			const tokline_t& tokens = tok_vec[i];
+			if (is_org(tokens)) {
+				pc = org_parse(tokens);
+				continue;
+			}
+			uint16_t iword = region->words[word_idx];
+			try {
+				for (; ref_idx < region->refs.size() && region->refs[ref_idx].word == word_idx; ref_idx++)
+					iword += label_parse(region->refs[ref_idx].label, label_opd, pc, label_map);
+				outfile.put(pc, iword);
+			} catch (const assem_error& err) {
+				throw source_error {tokens, err.what()};
+			}
+			word_idx++;
+			pc++;
+		}
+		begin = end;
+	}
+
+	incr_store(cache_file, opts.isa_hash, new_regions);
+	(opts.log ? *opts.log : std::cerr) << infile_name + ": reused " + std::to_string(reused) + " lines, re-encoded "
+		+ std::to_string(encoded) + " lines\n";
+}
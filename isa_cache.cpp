@@ -0,0 +1,222 @@
+#include <cstdint>
+#include <cstring>
+#include <cstdio> // for std::rename, std::remove
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <fstream>
+#include <stdexcept>
+#include <string_view>
+#include <thread> // for this_thread::get_id
+#include <functional> // for hash
+
+#include <unistd.h> // for getpid
+
+#include "eepasm.h"
+#include "bin_io.h"
+
+// binary ISA layout (host byte order):
+//   header: magic "EEPB", format version (u32), FNV-1a hash of source (u64),
+//           number of instructions (u32)
+//   per instruction: name (u16 length + bytes), position in config (u16), const_iword (u16),
+//                    number of alternatives (u16), lit names (u8 count, then
+//                    u8 length + bytes each), number of operand classes (u16),
+//                    match table (u32 count, then alternative (i8) and dup (u8)),
+//                    long form (u8 count, then u16 length + bytes each)
+//   per alternative: number of operands (u8)
+//   per operand: type (u8), lsb (u8), size (u8), mask (u16), ins8 (u16),
+//                lit_const (u16), name (u8 length + bytes)
+
+constexpr char isa_magic[4] = {'E', 'E', 'P', 'B'};
+constexpr uint32_t isa_version = 5;
+constexpr uint64_t fnv_prime = 0x100000001b3ULL;
+
+uint64_t fnv1a_hash(const char *data, size_t len, uint64_t hash) {
+	for (size_t i = 0; i < len; i++) {
+		hash ^= static_cast<unsigned char>(data[i]);
+		hash *= fnv_prime;
+	}
+	return hash;
+}
+
+std::string isa_serialize(const insmap_t& insmap, uint64_t src_hash) {
+	std::string buf;
+	buf.append(isa_magic, sizeof(isa_magic));
+	put<uint32_t>(buf, isa_version);
+	put<uint64_t>(buf, src_hash);
+	put<uint32_t>(buf, insmap.size());
+
+	for (const auto& [name, ins] : insmap) {
+		put_str<uint16_t>(buf, name);
+		put<uint16_t>(buf, ins.index);
+		put<uint16_t>(buf, ins.const_iword);
+		put<uint16_t>(buf, ins.alts.size());
+		put<uint8_t>(buf, ins.lit_names.size());
+		for (const auto& lit_name : ins.lit_names)
+			put_str<uint8_t>(buf, lit_name);
+		put<uint16_t>(buf, ins.nclasses);
+		put<uint32_t>(buf, ins.match_table.size());
+		for (const auto& match : ins.match_table) {
+			put<int8_t>(buf, match.alt);
+			put<uint8_t>(buf, match.dup);
+		}
+		put<uint8_t>(buf, ins.long_form.size());
+		for (const auto& line : ins.long_form)
+			put_str<uint16_t>(buf, line);
+		for (const auto& alt : ins.alts) {
+			put<uint8_t>(buf, alt.size());
+			for (const auto& opd : alt) {
+				put<uint8_t>(buf, static_cast<uint8_t>(opd.type));
+				put<uint8_t>(buf, opd.lsb);
+				put<uint8_t>(buf, opd.size);
+				put<uint16_t>(buf, opd.mask);
+				put<uint16_t>(buf, opd.ins8);
+				put<uint16_t>(buf, opd.lit_const);
+				put_str<uint8_t>(buf, opd.name);
+			}
+		}
+	}
+	return buf;
+}
+
+// copies the descriptors out of data (usually a mapping of the file) into
+// an insmap_t, which owns its strings and vectors: linear in the ISA size,
+// but without the text parsing and match table building of isa_parse
+insmap_t isa_deserialize(const char *data, size_t len) {
+	bin_reader in {data, len};
+	insmap_t outmap;
+
+	for (char c : isa_magic)
+		if (in.get<char>() != c)
+			throw parsing_error {"not a binary ISA file"};
+	if (in.get<uint32_t>() != isa_version)
+		throw parsing_error {"unsupported binary ISA version"};
+	in.get<uint64_t>(); // source hash, checked by caller
+
+	uint32_t nins = in.get<uint32_t>();
+	for (uint32_t i = 0; i < nins; i++) {
+		auto& ins = outmap[in.get_str<uint16_t>()];
+		ins.index = in.get<uint16_t>();
+		ins.const_iword = in.get<uint16_t>();
+		ins.alts.resize(in.get<uint16_t>());
+		ins.lit_names.resize(in.get<uint8_t>());
+		for (auto& lit_name : ins.lit_names)
+			lit_name = in.get_str<uint8_t>();
+		ins.nclasses = in.get<uint16_t>();
+		ins.match_table.resize(in.get<uint32_t>());
+		for (auto& match : ins.match_table) {
+			match.alt = in.get<int8_t>();
+			match.dup = in.get<uint8_t>();
+			if (match.alt >= static_cast<int>(ins.alts.size()))
+				throw parsing_error {"invalid alternative in binary ISA"};
+		}
+		ins.long_form.resize(in.get<uint8_t>());
+		for (auto& line : ins.long_form)
+			line = in.get_str<uint16_t>();
+		for (auto& alt : ins.alts) {
+			alt.resize(in.get<uint8_t>());
+			for (auto& opd : alt) {
+				uint8_t type = in.get<uint8_t>();
+				if (type >= num_optypes)
+					throw parsing_error {"invalid operand type in binary ISA"};
+				opd.type = static_cast<optype_t>(type);
+				opd.lsb = in.get<uint8_t>();
+				opd.size = in.get<uint8_t>();
+				opd.mask = in.get<uint16_t>();
+				opd.ins8 = in.get<uint16_t>();
+				opd.lit_const = in.get<uint16_t>();
+				opd.name = in.get_str<uint8_t>();
+			}
+		}
+	}
+	return outmap;
+}
+
+bool is_compiled_isa(const char *data, size_t len) {
+	return len >= sizeof(isa_magic) && std::memcmp(data, isa_magic, sizeof(isa_magic)) == 0;
+}
+
+// hash stored in header of a compiled ISA
+uint64_t compiled_isa_hash(const char *data, size_t len) {
+	bin_reader in {data + sizeof(isa_magic), len - sizeof(isa_magic)};
+	in.get<uint32_t>();
+	return in.get<uint64_t>();
+}
+
+std::string isa_cache_path(const std::string& conf_file) {
+	return replace_ext(conf_file, isa_bin_ext);
+}
+
+// write to temporary file and rename so concurrent assembler runs never see
+// a partially written file
+bool write_file_atomic(const std::string& path, const std::string& data) {
+	std::string tmp_file = path + ".tmp" + std::to_string(getpid()) + "."
+		+ std::to_string(std::hash<std::thread::id> {}(std::this_thread::get_id()));
+	std::ofstream outfile {tmp_file, std::ios::binary};
+	if (!outfile.is_open())
+		return false;
+	outfile.write(data.data(), data.size());
+	outfile.close();
+	if (!outfile || std::rename(tmp_file.c_str(), path.c_str()) != 0) {
+		std::remove(tmp_file.c_str());
+		return false;
+	}
+	return true;
+}
+
+bool isa_write(const insmap_t& insmap, uint64_t src_hash, const std::string& out_file) {
+	return write_file_atomic(out_file, isa_serialize(insmap, src_hash));
+}
+
+void isa_compile(const std::string& conf_file, const std::string& out_file) {
+	file_map src {conf_file};
+	if (!src.is_open())
+		error("Can't open instruction list config file '" + conf_file + "'");
+
+	insmap_t insmap = insmap_gen(conf_file);
+	if (!isa_write(insmap, fnv1a_hash(src.data(), src.size()), out_file))
+		error("can't write binary ISA file '" + out_file + "'");
+}
+
+// ISA of conf_file through the compiled cache next to it; throws
+// parsing_error instead of exiting
+insmap_t isa_read(const std::string& conf_file) {
+	file_map src {conf_file};
+	if (!src.is_open())
+		throw parsing_error {"Can't open instruction list config file '" + conf_file + "'"};
+
+	try {
+		// config given in compiled form directly
+		if (is_compiled_isa(src.data(), src.size()))
+			return isa_deserialize(src.data(), src.size());
+	} catch (const parsing_error& err) {
+		throw parsing_error {"binary ISA file '" + conf_file + "': " + err.what()};
+	}
+
+	uint64_t src_hash = fnv1a_hash(src.data(), src.size());
+	std::string cache_file = isa_cache_path(conf_file);
+	file_map cache {cache_file};
+	if (cache.is_open() && is_compiled_isa(cache.data(), cache.size())) {
+		try {
+			if (compiled_isa_hash(cache.data(), cache.size()) == src_hash)
+				return isa_deserialize(cache.data(), cache.size());
+		} catch (const parsing_error& err) {
+			// stale or corrupt cache: fall through and rebuild it
+		}
+	}
+
+	std::ifstream cfile {conf_file};
+	insmap_t insmap = isa_parse(cfile);
+	if (cache_file != conf_file)
+		isa_write(insmap, src_hash, cache_file); // cache is best effort only
+	return insmap;
+}
+
+insmap_t isa_load(const std::string& conf_file) {
+	try {
+		return isa_read(conf_file);
+	} catch (const parsing_error& err) {
+		error(err.what());
+	}
+	return {};
+}
@@ -0,0 +1,152 @@
+#include <iostream>
+#include <fstream>
+#include <unordered_map>
+#include <functional> // for function objects
+#include <vector>
+#include <stdexcept>
+#include <cstdint>
+#include <string>
+
+#include "eepasm.h"
+
+// reading of the instruction definition config file, shared by every tool
+
+const std::unordered_map<std::string, std::function<operand_t(std::istream&)>> opvec_gen_fns {
+	{"reg", reg_opgen},
+	{"imm", imm_opgen},
+	{"label", no_opgen},
+	{"lit", lit_opgen},
+};
+
+void error(const std::string& msg) {
+	std::cerr << "Error: " << msg << std::endl;
+	std::exit(EXIT_FAILURE);
+}
+
+insmap_t insmap_gen(const std::string& conf_file) {
+	std::ifstream cfile {conf_file};
+	if (!cfile.is_open())
+		error("Can't open instruction list config file '" + conf_file + "'");
+	try {
+		return isa_parse(cfile);
+	} catch (const parsing_error& err) {
+		error(err.what());
+	}
+	return {};
+}
+
+// instruction definitions of a config file read from cfile; throws
+// parsing_error naming the instruction instead of exiting
+insmap_t isa_parse(std::istream& cfile) {
+	insmap_t outmap;
+	std::vector<oplist_t> alternatives_vec;
+	std::vector<std::string> long_vec; // long form of the alternatives, copied with them
+	std::string ins_name, instr;
+	int numops;
+
+	while ((ins_name = get_low_str(cfile)) != "") {
+		// process instructions stored in instr
+	
+		try {
+			instr = get_low_str(cfile);
+			auto [ins_it, added] = outmap.try_emplace(ins_name);
+			insdef_t& ins = ins_it->second;
+			if (added)
+				ins.index = outmap.size() - 1;
+			bool copied = instr == "copy";
+			if (copied) {
+				ins.alts = alternatives_vec;
+				ins.long_form = long_vec;
+				instr = get_low_str(cfile);
+			} else if (instr == "numops") {
+				alternatives_vec.clear();
+				long_vec.clear();
+				while (instr == "numops") {
+					cfile >> numops; // numops value
+					if (numops > max_ops)
+						throw parsing_error {"can't have more than 3 operands"};
+					if (alternatives_vec.size() == INT8_MAX)
+						throw parsing_error {"too many alternatives"};
+					alternatives_vec.push_back(opvec_gen(cfile, numops));
+					instr = get_low_str(cfile);
+				}
+				ins.alts = alternatives_vec;
+			} else {
+				// instruction without operands
+				ins.alts = {oplist_t {}};
+			}
+
+			// long form: the rest of every line starting with long
+			if (instr == "long") {
+				ins.long_form.clear();
+				while (instr == "long") {
+					if (ins.long_form.size() == UINT8_MAX)
+						throw parsing_error {"too many long lines"};
+					std::string line;
+					std::getline(cfile, line);
+					size_t start = line.find_first_not_of(" \t\r");
+					if (start == std::string::npos)
+						throw parsing_error {"empty long line"};
+					ins.long_form.push_back(line.substr(start, line.find_last_not_of(" \t\r") + 1 - start));
+					instr = get_low_str(cfile);
+				}
+				if (!copied)
+					long_vec = ins.long_form;
+			}
+
+			// while already read string const_iword
+			if (instr != "const_iword")
+				throw parsing_error {"missing const_iword field"};
+			instr = get_low_str(cfile); // string of const_iword
+			ins.const_iword = num_parse(instr);
+			match_table_gen(ins);
+		} catch (const parsing_error& err) {
+			throw parsing_error {"parsing (" + ins_name + "): " + err.what()};
+		} catch (const std::logic_error& err) {
+			throw parsing_error {"parsing (" + ins_name + "): invalid number"};
+		}
+	}
+
+	return outmap;
+}
+
+// hash of everything encoding an instruction depends on (not the lit names:
+// they only select the alternative)
+uint64_t insdef_hash(const insdef_t& ins) {
+	uint64_t hash = fnv1a_hash(reinterpret_cast<const char *>(&ins.const_iword), sizeof(ins.const_iword));
+	for (const auto& line : ins.long_form)
+		hash = fnv1a_hash(line.c_str(), line.size() + 1, hash);
+	for (const auto& alt : ins.alts) {
+		uint16_t fields[] = {static_cast<uint16_t>(alt.size())};
+		hash = fnv1a_hash(reinterpret_cast<const char *>(fields), sizeof(fields), hash);
+		for (const auto& opd : alt) {
+			uint16_t opd_fields[] = {static_cast<uint16_t>(opd.type), opd.lsb, opd.size, opd.mask, opd.ins8, opd.lit_const};
+			hash = fnv1a_hash(reinterpret_cast<const char *>(opd_fields), sizeof(opd_fields), hash);
+		}
+	}
+	return hash;
+}
+
+oplist_t opvec_gen(std::istream& cfile, int numops) {
+	oplist_t outvec;
+	std::string instr, type;
+
+
+	for (int i = 0; i < numops; i++) {
+		instr = get_low_str(cfile);
+		if (instr != "op")
+			throw parsing_error {"missing op indicator"};
+
+		instr = get_low_str(cfile);
+		if (instr != "type")
+			throw parsing_error {"type field missing"};
+
+		type = get_low_str(cfile);
+		auto gen_it = opvec_gen_fns.find(type);
+		if (gen_it == opvec_gen_fns.end())
+			throw parsing_error {"invaid operand type"};
+
+		outvec.push_back(gen_it->second(cfile));
+	}
+	return outvec;
+}
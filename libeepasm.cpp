@@ -0,0 +1,73 @@
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <utility> // for pair, move
+#include <sstream>
+#include <stdexcept>
+#include <cstdint>
+
+#include "libeepasm.h"
+
+// The assembler as a library: the same passes as assemble_file, with the
+// words collected in memory and every line error kept instead of stopping
+// at the first one.
+
+assembler::assembler() : insmap {builtin_isa()} {
+	encoders_attach(insmap);
+}
+
+assembler::assembler(insmap_t isa) : insmap {std::move(isa)} {}
+
+assembler assembler::from_file(const std::string& conf_file) {
+	file_map src {conf_file};
+	if (!src.is_open())
+		throw parsing_error {"can't open instruction list config file '" + conf_file + "'"};
+	return from_text(src.view());
+}
+
+assembler assembler::from_text(std::string_view conf) {
+	std::istringstream cfile {std::string {conf}};
+	insmap_t isa = isa_parse(cfile);
+	encoders_attach(isa);
+	return assembler {std::move(isa)};
+}
+
+asm_diag_t diag_make(const source_error& err) {
+	return {err.line, err.col, err.token, err.msg, err.file};
+}
+
+asm_result_t assembler::assemble(std::string_view src) const {
+	asm_result_t out;
+	std::pair<tokvec_t, symtab_t> pass1;
+	std::string long_text;
+	module_refs_t modules {*this->modules};
+	try {
+		pass1 = tokenize_file(src, insmap, modules);
+		relax(insmap, pass1.first, pass1.second, long_text);
+	} catch (const source_error& err) {
+		// addresses after an invalid org are unknown
+		out.diags.push_back(diag_make(modules.locate(err)));
+		return out;
+	}
+	const auto& [tok_vec, label_map] = pass1;
+	for (const auto& sym : label_map.syms)
+		if (sym.value >= 0)
+			out.symbols.push_back({std::string {sym.name}, sym.value, sym.line});
+
+	out.words.reserve(tok_vec.size());
+	int pc = 0;
+	for (const auto& tokens : tok_vec) {
+		try {
+			if (is_org(tokens)) {
+				pc = org_parse(tokens);
+				continue;
+			}
+			out.words.push_back({pc, encode_line(insmap, tokens, pc, label_map)});
+		} catch (const source_error& err) {
+			out.diags.push_back(diag_make(modules.locate(err)));
+		}
+		pc++;
+	}
+	return out;
+}
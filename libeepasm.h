@@ -0,0 +1,59 @@
+#ifndef LIBEEPASM_H
+#define LIBEEPASM_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <utility> // for pair
+#include <memory> // for unique_ptr
+#include <stdexcept>
+#include <cstdint>
+
+#include "eepasm.h"
+#include "module_cache.h"
+
+// error of one source line
+struct asm_diag_t {
+	int line; // starting at 1
+	int col; // of the first token
+	std::string token; // first token of the line
+	std::string msg;
+	std::string file; // included file the line is in, empty for the source itself
+};
+
+// label defined in the source
+struct asm_symbol_t {
+	std::string name;
+	int addr;
+	int line; // of the definition
+};
+
+struct asm_result_t {
+	std::vector<std::pair<int, uint16_t>> words; // address and word in source order
+	std::vector<asm_symbol_t> symbols; // in order of first definition or use
+	std::vector<asm_diag_t> diags; // in source order, empty if it assembled
+	bool ok() const { return diags.empty(); }
+};
+
+// In-process assembler for embedding (libeepasm.a): the ISA is loaded once
+// and assemble() only reads it, so one assembler can serve any number of
+// threads at the same time. All state is in the assembler: besides the ISA
+// its module cache of included files, which is locked while it is changed.
+// Assemblers share nothing. Nothing here exits the process: errors in the
+// ISA throw parsing_error, errors in the source become diagnostics.
+class assembler {
+public:
+	assembler(); // built-in ISA
+	explicit assembler(insmap_t isa);
+	static assembler from_file(const std::string& conf_file);
+	static assembler from_text(std::string_view conf);
+
+	asm_result_t assemble(std::string_view src) const;
+	const insmap_t& isa() const { return insmap; }
+private:
+	insmap_t insmap;
+	std::unique_ptr<module_cache_t> modules = std::make_unique<module_cache_t>(); // for insmap
+};
+
+#endif
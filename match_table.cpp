@@ -0,0 +1,229 @@
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <map>
+#include <algorithm> // for sort, find
+#include <iostream>
+#include <stdexcept>
+#include <string_view>
+
+#include "eepasm.h"
+
+// Every operand token falls into one operand class:
+//   class = lit_idx * num_cls_base + base
+// where base says if the token looks like a register, an immediate or neither
+// and lit_idx is 1 + the index of the token in the lit names of the instruction
+// (0 if it is none of them).
+// The match table of an instruction holds the selected alternative for every
+// tuple of operand classes with 0 to max_ops operands:
+//   index = offset(n) + c[0] + c[1] * nclasses + c[2] * nclasses^2
+// with offset(n) = 1 + nclasses + ... + nclasses^(n-1).
+
+enum cls_base { cls_reg, cls_imm, cls_other, num_cls_base };
+
+int table_offset(int nops, int nclasses) {
+	int off = 0, pow = 1;
+	for (int i = 0; i < nops; i++, pow *= nclasses)
+		off += pow;
+	return off;
+}
+
+int table_index(const std::vector<int>& classes, int nclasses) {
+	int idx = 0, pow = 1;
+	for (int c : classes) {
+		idx += c * pow;
+		pow *= nclasses;
+	}
+	return table_offset(classes.size(), nclasses) + idx;
+}
+
+// 1 + index of name in the lit names of ins, 0 if it is none of them: one
+// probe with the perfect hash of the built-in ISA, else a scan
+int lit_idx(const insdef_t& ins, std::string_view name) {
+	if (ins.lit_hash) {
+		if (ins.lit_names.empty())
+			return 0;
+		int id = ins.lit_hash(name);
+		return id < 0 ? 0 : ins.lit_ids[id];
+	}
+	for (size_t i = 0; i < ins.lit_names.size(); i++)
+		if (ci_eq(ins.lit_names[i], name))
+			return i + 1;
+	return 0;
+}
+
+int class_base(std::string_view op) {
+	return reg_check(op) ? cls_reg : (imm_check(op) ? cls_imm : cls_other);
+}
+
+int op_class(std::string_view op, const insdef_t& ins) {
+	return lit_idx(ins, op) * num_cls_base + class_base(op);
+}
+
+// a lit name always has the base class of its first character
+bool class_valid(const insdef_t& ins, int cls) {
+	int lit = cls / num_cls_base;
+	return lit == 0 || class_base(ins.lit_names[lit - 1]) == cls % num_cls_base;
+}
+
+bool op_accepts(const insdef_t& ins, const operand_t& opd, int cls) {
+	switch (opd.type) {
+	case optype_t::reg:
+		return cls % num_cls_base == cls_reg;
+	case optype_t::imm:
+		return cls % num_cls_base == cls_imm;
+	case optype_t::label:
+		return true;
+	case optype_t::lit:
+		return cls / num_cls_base == lit_idx(ins, opd.name);
+	}
+	return false;
+}
+
+bool alt_accepts(const insdef_t& ins, const oplist_t& alt, const std::vector<int>& classes) {
+	if (alt.size() != classes.size())
+		return false;
+	for (size_t i = 0; i < alt.size(); i++)
+		if (!op_accepts(ins, alt[i], classes[i]))
+			return false;
+	return true;
+}
+
+// operand classes with first operand duplicated for 2 operand shorthand
+std::vector<int> dup_classes(const std::vector<int>& classes) {
+	std::vector<int> out {classes[0]};
+	out.insert(out.end(), classes.begin(), classes.end());
+	return out;
+}
+
+// all alternatives accepting given operand classes in order of preference:
+// alternatives with the same number of operands come first, then the
+// 3 operand ones matching when the first of 2 operands is duplicated
+std::vector<match_t> match_candidates(const insdef_t& ins, const std::vector<int>& classes) {
+	std::vector<match_t> out;
+	for (size_t i = 0; i < ins.alts.size(); i++)
+		if (alt_accepts(ins, ins.alts[i], classes))
+			out.push_back({static_cast<int8_t>(i), false});
+	if (classes.size() == 2) {
+		std::vector<int> dup = dup_classes(classes);
+		for (size_t i = 0; i < ins.alts.size(); i++)
+			if (alt_accepts(ins, ins.alts[i], dup))
+				out.push_back({static_cast<int8_t>(i), true});
+	}
+	return out;
+}
+
+// calls fn for every possible tuple of operand classes with 0 to max_ops operands
+template <typename F>
+void for_all_classes(const insdef_t& ins, F fn) {
+	std::vector<int> classes;
+	for (int nops = 0; nops <= max_ops; nops++) {
+		classes.assign(nops, 0);
+		while (true) {
+			if (std::all_of(classes.begin(), classes.end(), [&](int c) { return class_valid(ins, c); }))
+				fn(classes);
+			int i = 0;
+			while (i < nops && ++classes[i] == ins.nclasses)
+				classes[i++] = 0;
+			if (i == nops)
+				break;
+		}
+	}
+}
+
+void match_table_gen(insdef_t& ins) {
+	ins.lit_names.clear();
+	for (const auto& alt : ins.alts)
+		for (const auto& opd : alt)
+			if (opd.type == optype_t::lit && lit_idx(ins, opd.name) == 0)
+				ins.lit_names.push_back(opd.name);
+
+	ins.nclasses = num_cls_base * (ins.lit_names.size() + 1);
+	ins.match_table.assign(table_offset(max_ops + 1, ins.nclasses), match_t {});
+	for_all_classes(ins, [&](const std::vector<int>& classes) {
+		std::vector<match_t> cand = match_candidates(ins, classes);
+		if (!cand.empty())
+			ins.match_table[table_index(classes, ins.nclasses)] = cand[0];
+	});
+}
+
+match_t ins_match(const insdef_t& ins, const tokline_t& tokens) {
+	int nops = tokens.nops();
+	if (nops > max_ops)
+		return match_t {};
+	int idx = 0, pow = 1;
+	for (int i = 0; i < nops; i++, pow *= ins.nclasses)
+		idx += op_class(tokens.op(i), ins) * pow;
+	return ins.match_table[table_offset(nops, ins.nclasses) + idx];
+}
+
+std::string class_name(const insdef_t& ins, int cls) {
+	if (cls / num_cls_base > 0)
+		return ins.lit_names[cls / num_cls_base - 1];
+	switch (cls % num_cls_base) {
+	case cls_reg:
+		return "reg";
+	case cls_imm:
+		return "imm";
+	default:
+		return "label";
+	}
+}
+
+std::string alt_name(const match_t& m) {
+	return "alternative " + std::to_string(m.alt + 1) + (m.dup ? " (2 operand shorthand)" : "");
+}
+
+bool isa_check(const insmap_t& insmap, std::ostream& out) {
+	std::vector<std::string> names;
+	for (const auto& [name, ins] : insmap)
+		names.push_back(name);
+	std::sort(names.begin(), names.end());
+
+	bool failed = false; // unreachable alternatives or bad long forms
+	for (const auto& name : names) {
+		const insdef_t& ins = insmap.at(name);
+		std::vector<bool> reached(ins.alts.size());
+		// first operand classes for which one alternative shadows another
+		std::map<std::pair<int, int>, std::string> shadowed;
+
+		for_all_classes(ins, [&](const std::vector<int>& classes) {
+			std::vector<match_t> cand = match_candidates(ins, classes);
+			if (cand.empty())
+				return;
+			reached[cand[0].alt] = true;
+			for (size_t i = 1; i < cand.size(); i++) {
+				auto key = std::make_pair(cand[0].alt * 2 + cand[0].dup, cand[i].alt * 2 + cand[i].dup);
+				if (shadowed.find(key) != shadowed.end())
+					continue;
+				std::string ops;
+				for (int c : classes)
+					ops += (ops == "" ? "" : ", ") + class_name(ins, c);
+				shadowed[key] = ops;
+			}
+		});
+
+		for (const auto& [key, ops] : shadowed) {
+			match_t first {static_cast<int8_t>(key.first / 2), static_cast<bool>(key.first % 2)};
+			match_t second {static_cast<int8_t>(key.second / 2), static_cast<bool>(key.second % 2)};
+			out << name << ": ambiguous: " << alt_name(first) << " shadows "
+				<< alt_name(second) << " for operands (" << ops << ")\n";
+		}
+		for (size_t i = 0; i < reached.size(); i++) {
+			if (!reached[i]) {
+				out << name << ": unreachable: alternative " << i + 1 << "\n";
+				failed = true;
+			}
+		}
+		// every line of the long form must name an instruction
+		for (const auto& line : ins.long_form) {
+			std::string_view mnemonic = std::string_view {line}.substr(0, line.find_first_of(" \t"));
+			if (!ci_eq(mnemonic, "%ins") && !insmap.lookup(mnemonic)) {
+				out << name << ": long form: unknown instruction '" << mnemonic << "'\n";
+				failed = true;
+			}
+		}
+	}
+	return !failed;
+}
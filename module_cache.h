@@ -0,0 +1,52 @@
+#ifndef MODULE_CACHE_H
+#define MODULE_CACHE_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <map>
+#include <memory> // for shared_ptr
+#include <mutex>
+#include <stdexcept>
+#include <cstdint>
+
+#include "eepasm.h"
+
+// Included files lexed once per content as modules (see include.cpp), for
+// one ISA: whoever runs the jobs (a batch, a server for each of its ISAs, a
+// library assembler) keeps one cache for all of them. The last content of
+// every file is kept; including a file whose modification time or size
+// changed lexes it again and drops the module of its old content unless
+// another file has it too.
+class module_cache_t {
+public:
+	// module of the file at path lexed for insmap, the same ISA on every call
+	std::shared_ptr<const module_t> get(const std::string& path, const insmap_t& insmap, asm_stats_t *stats);
+private:
+	struct file_t {
+		uint64_t hash; // of the content last lexed
+		int64_t mtime_ns;
+		int64_t size;
+	};
+
+	std::mutex lock;
+	std::unordered_map<uint64_t, std::shared_ptr<const module_t>> modules; // by hash of the content
+	std::unordered_map<std::string, file_t> files; // by real path
+};
+
+// modules linked into the token records of one job, which point into their
+// text: kept alive here even if the cache drops them meanwhile
+class module_refs_t {
+public:
+	explicit module_refs_t(module_cache_t& cache) : cache {cache} {}
+
+	const module_t& get(const std::string& path, const insmap_t& insmap, asm_stats_t *stats = nullptr);
+	std::string file_of(const char *text) const; // included file of the line at text, empty if none
+	source_error locate(const source_error& err) const; // err with the included file of its line
+private:
+	module_cache_t& cache;
+	std::map<const char *, std::shared_ptr<const module_t>> used; // by start of text
+};
+
+#endif
@@ -0,0 +1,114 @@
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <stdexcept>
+#include <cstdint>
+
+#include "eepasm.h"
+#include "bin_io.h"
+
+// relocatable object file (eepasm -r, read by eepld), host byte order:
+//   magic "EEPO", version (u32), source file name (u16 length + bytes)
+//   number of sections (u32), per section:
+//     fixed (u8), address (u32), number of words (u32), words (u16 each)
+//   number of symbols (u32), per symbol:
+//     name (u16 length + bytes), section (i32, -1 imported, -2 fixed address), value (u32),
+//     line of the definition (u32)
+//   number of relocations (u32), per relocation:
+//     section (u32), word (u32), symbol (u32), lsb (u8), size (u8)
+
+constexpr char obj_magic[4] = {'E', 'E', 'P', 'O'};
+constexpr uint32_t obj_version = 1;
+
+std::string obj_serialize(const object_t& obj) {
+	std::string buf;
+	buf.append(obj_magic, sizeof(obj_magic));
+	put<uint32_t>(buf, obj_version);
+	put_str<uint16_t>(buf, obj.source);
+	put<uint32_t>(buf, obj.sections.size());
+	for (const auto& section : obj.sections) {
+		put<uint8_t>(buf, section.fixed);
+		put<uint32_t>(buf, section.addr);
+		put<uint32_t>(buf, section.words.size());
+		for (uint16_t word : section.words)
+			put<uint16_t>(buf, word);
+	}
+	put<uint32_t>(buf, obj.symbols.size());
+	for (const auto& sym : obj.symbols) {
+		put_str<uint16_t>(buf, sym.name);
+		put<int32_t>(buf, sym.section);
+		put<uint32_t>(buf, sym.value);
+		put<uint32_t>(buf, sym.line);
+	}
+	put<uint32_t>(buf, obj.relocs.size());
+	for (const auto& reloc : obj.relocs) {
+		put<uint32_t>(buf, reloc.section);
+		put<uint32_t>(buf, reloc.word);
+		put<uint32_t>(buf, reloc.symbol);
+		put<uint8_t>(buf, reloc.lsb);
+		put<uint8_t>(buf, reloc.size);
+	}
+	return buf;
+}
+
+void obj_save(const object_t& obj, const std::string& path) {
+	if (path == "-")
+		throw assem_error {"objects can't be written to standard output"};
+	if (!write_file_atomic(path, obj_serialize(obj)))
+		throw assem_error {"can't write object file '" + path + "'"};
+}
+
+// object written by obj_save, checked for consistency; throws parsing_error
+object_t obj_load(const std::string& path) {
+	file_map file {path};
+	if (!file.is_open())
+		throw parsing_error {"can't open object file '" + path + "'"};
+	object_t obj;
+	try {
+		bin_reader in {file.data(), file.size()};
+		for (char c : obj_magic)
+			if (in.get<char>() != c)
+				throw parsing_error {"not an object file"};
+		if (in.get<uint32_t>() != obj_version)
+			throw parsing_error {"object file version differs, assemble again"};
+		obj.source = in.get_str<uint16_t>();
+		obj.sections.resize(in.get<uint32_t>());
+		for (auto& section : obj.sections) {
+			section.fixed = in.get<uint8_t>();
+			section.addr = in.get<uint32_t>();
+			section.words.resize(in.get<uint32_t>());
+			for (auto& word : section.words)
+				word = in.get<uint16_t>();
+		}
+		if (obj.sections.empty() || obj.sections[0].fixed)
+			throw parsing_error {"first section must be relocatable"};
+		obj.symbols.resize(in.get<uint32_t>());
+		for (auto& sym : obj.symbols) {
+			sym.name = in.get_str<uint16_t>();
+			sym.section = in.get<int32_t>();
+			sym.value = in.get<uint32_t>();
+			sym.line = in.get<uint32_t>();
+			if (sym.section < sym_abs || sym.section >= static_cast<int>(obj.sections.size()))
+				throw parsing_error {"invalid section of symbol '" + sym.name + "'"};
+		}
+		obj.relocs.resize(in.get<uint32_t>());
+		for (auto& reloc : obj.relocs) {
+			reloc.section = in.get<uint32_t>();
+			reloc.word = in.get<uint32_t>();
+			reloc.symbol = in.get<uint32_t>();
+			reloc.lsb = in.get<uint8_t>();
+			reloc.size = in.get<uint8_t>();
+			if (reloc.section < 0 || reloc.section >= static_cast<int>(obj.sections.size())
+					|| reloc.word < 0 || reloc.word >= static_cast<int>(obj.sections[reloc.section].words.size())
+					|| reloc.symbol < 0 || reloc.symbol >= static_cast<int>(obj.symbols.size())
+					|| reloc.size < 1 || reloc.lsb + reloc.size > 16)
+				throw parsing_error {"invalid relocation"};
+		}
+		if (!in.at_end())
+			throw parsing_error {"trailing data"};
+	} catch (const parsing_error& err) {
+		throw parsing_error {"object file '" + path + "': " + err.what()};
+	}
+	return obj;
+}
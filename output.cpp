@@ -0,0 +1,283 @@
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <array>
+#include <stdexcept>
+#include <cstdint>
+#include <cstring> // for memcpy
+#include <algorithm> // for min
+#include <chrono>
+
+#include <fcntl.h> // for open
+#include <unistd.h> // for write, pwrite, close
+
+#include "eepasm.h"
+
+constexpr size_t out_buf_size = 1 << 20;
+constexpr int ihex_rec_size = 16; // data bytes per Intel HEX record
+
+constexpr char hex_digits[2][17] = {"0123456789abcdef", "0123456789ABCDEF"};
+
+// two hex digits for every byte value, lowercase and uppercase
+constexpr auto hex_pairs = [] {
+	std::array<std::array<std::array<char, 2>, 256>, 2> table {};
+	for (int upper = 0; upper < 2; upper++)
+		for (int i = 0; i < 256; i++)
+			table[upper][i] = {hex_digits[upper][i >> 4], hex_digits[upper][i & 0xf]};
+	return table;
+}();
+
+// write val as hex with at least min_digits digits, returns end of output
+char *put_hex(char *out, unsigned val, int min_digits, bool upper) {
+	int digits = min_digits;
+	while (digits < 8 && (val >> (digits * 4)) != 0)
+		digits++;
+	if (digits % 2)
+		*out++ = hex_digits[upper][(val >> (--digits * 4)) & 0xf];
+	for (int i = digits - 2; i >= 0; i -= 2) {
+		std::memcpy(out, hex_pairs[upper][(val >> (i * 4)) & 0xff].data(), 2);
+		out += 2;
+	}
+	return out;
+}
+
+// "0x<pc> 0x<iword>" line of the .ram format without newline
+char *put_ram_line(char *out, int pc, uint16_t iword) {
+	*out++ = '0';
+	*out++ = 'x';
+	out = put_hex(out, pc, 2);
+	std::memcpy(out, " 0x", 3);
+	return put_hex(out + 3, iword, 4);
+}
+
+std::string ins2str(int pc, uint16_t iword) {
+	char buf[32];
+	return std::string(buf, put_ram_line(buf, pc, iword) - buf);
+}
+
+outfmt_t outfmt_parse(const std::string& name) {
+	static const std::unordered_map<std::string, outfmt_t> formats {
+		{"ram", outfmt_t::ram},
+		{"raw", outfmt_t::raw_le},
+		{"rawbe", outfmt_t::raw_be},
+		{"ihex", outfmt_t::ihex},
+		{"sparse", outfmt_t::sparse},
+	};
+	auto it = formats.find(name);
+	if (it == formats.end())
+		throw assem_error {"unknown output format '" + name + "'"};
+	return it->second;
+}
+
+std::string outfmt_ext(outfmt_t fmt) {
+	switch (fmt) {
+	case outfmt_t::ram:
+		return ".ram";
+	case outfmt_t::raw_le:
+	case outfmt_t::raw_be:
+		return ".bin";
+	case outfmt_t::ihex:
+		return ".hex";
+	case outfmt_t::sparse:
+		return ".eeps";
+	}
+	return ".ram";
+}
+
+out_writer::out_writer(const std::string& path, outfmt_t fmt, int stdout_fd) : fmt {fmt}, path {path} {
+	if (path == "-")
+		fd = stdout_fd;
+	else
+		fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd == -1)
+		throw assem_error {"can't open output file '" + path + "'"};
+	buf.resize(out_buf_size);
+	if (fmt != outfmt_t::ram) {
+		image.resize(image_size);
+		used.resize(image_size);
+	}
+}
+
+out_writer::~out_writer() {
+	if (fd != -1 && path != "-")
+		::close(fd);
+}
+
+void out_writer::flush() {
+	auto start = timed ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point {};
+	const char *p = buf.data();
+	size_t left = fill;
+	while (left > 0) {
+		ssize_t n = ::write(fd, p, left);
+		if (n <= 0)
+			throw assem_error {"can't write output file '" + path + "'"};
+		p += n;
+		left -= n;
+	}
+	flushed += fill;
+	fill = 0;
+	if (timed)
+		write_secs += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+char *out_writer::reserve(size_t len) {
+	if (fill + len > buf.size())
+		flush();
+	return buf.data() + fill;
+}
+
+void out_writer::write_bytes(const char *data, size_t len) {
+	while (len > 0) {
+		size_t chunk = std::min(len, buf.size() - fill);
+		if (chunk == 0) {
+			flush();
+			continue;
+		}
+		std::memcpy(buf.data() + fill, data, chunk);
+		fill += chunk;
+		data += chunk;
+		len -= chunk;
+	}
+}
+
+long out_writer::put(int pc, uint16_t iword) {
+	if (fmt != outfmt_t::ram) {
+		if (pc < 0 || pc >= image_size)
+			throw assem_error {"address " + std::to_string(pc) + " out of range for output format"};
+		image[pc] = iword;
+		used[pc] = true;
+		return pc;
+	}
+
+	char *start = reserve(32);
+	char *out = put_ram_line(start, pc, iword);
+	*out++ = '\n';
+	fill += out - start;
+	return flushed + fill - 5; // offset of word digits
+}
+
+void out_writer::patch(long handle, int pc, uint16_t iword) {
+	if (fmt != outfmt_t::ram) {
+		image[handle] = iword;
+		return;
+	}
+
+	char digits[4];
+	put_hex(digits, iword, 4);
+	if (handle >= static_cast<long>(flushed)) {
+		std::memcpy(buf.data() + (handle - flushed), digits, 4);
+	} else if (pwrite(fd, digits, 4, handle) != 4) {
+		throw assem_error {"can't patch output file '" + path + "': it must be seekable"};
+	}
+}
+
+// Intel HEX record with given type, byte address and data
+void out_writer::ihex_record(int type, unsigned addr, const uint8_t *data, int len) {
+	char *start = reserve(2 * ihex_rec_size + 16);
+	char *out = start;
+	uint8_t sum = len + (addr >> 8) + addr + type;
+	*out++ = ':';
+	out = put_hex(out, len, 2, true);
+	out = put_hex(out, addr & 0xffff, 4, true);
+	out = put_hex(out, type, 2, true);
+	for (int i = 0; i < len; i++) {
+		out = put_hex(out, data[i], 2, true);
+		sum += data[i];
+	}
+	out = put_hex(out, static_cast<uint8_t>(-sum), 2, true);
+	*out++ = '\n';
+	fill += out - start;
+}
+
+void out_writer::write_raw(bool big_endian) {
+	int end = image_size;
+	while (end > 0 && !used[end - 1])
+		end--;
+	for (int pc = 0; pc < end; pc++) {
+		char *out = reserve(2);
+		uint16_t iword = image[pc];
+		out[big_endian ? 1 : 0] = iword & 0xff;
+		out[big_endian ? 0 : 1] = iword >> 8;
+		fill += 2;
+	}
+}
+
+// words are stored little endian at byte address 2 * pc
+void out_writer::write_ihex() {
+	unsigned upper = 0;
+	for (int pc = 0; pc < image_size;) {
+		if (!used[pc]) {
+			pc++;
+			continue;
+		}
+		uint8_t data[ihex_rec_size];
+		unsigned addr = 2 * pc;
+		if ((addr >> 16) != upper) {
+			upper = addr >> 16;
+			uint8_t ext[2] = {static_cast<uint8_t>(upper >> 8), static_cast<uint8_t>(upper)};
+			ihex_record(4, 0, ext, 2);
+		}
+		// records neither cross a gap nor a 64K boundary
+		int len = 0;
+		while (len < ihex_rec_size && pc < image_size && used[pc] && ((2 * pc) >> 16) == upper) {
+			data[len++] = image[pc] & 0xff;
+			data[len++] = image[pc] >> 8;
+			pc++;
+		}
+		ihex_record(0, addr, data, len);
+	}
+	ihex_record(1, 0, nullptr, 0);
+}
+
+// "EEPS", number of segments (u32), then for every segment of consecutive
+// words: start address (u32), number of words (u32), words; all little endian
+void out_writer::write_sparse() {
+	std::vector<std::pair<int, int>> segments;
+	for (int pc = 0; pc < image_size; pc++) {
+		if (!used[pc])
+			continue;
+		if (!segments.empty() && segments.back().first + segments.back().second == pc)
+			segments.back().second++;
+		else
+			segments.push_back({pc, 1});
+	}
+
+	auto put_u32 = [this](uint32_t val) {
+		uint8_t bytes[4] = {static_cast<uint8_t>(val), static_cast<uint8_t>(val >> 8),
+			static_cast<uint8_t>(val >> 16), static_cast<uint8_t>(val >> 24)};
+		write_bytes(reinterpret_cast<const char *>(bytes), 4);
+	};
+	write_bytes("EEPS", 4);
+	put_u32(segments.size());
+	for (const auto& [start, len] : segments) {
+		put_u32(start);
+		put_u32(len);
+		for (int pc = start; pc < start + len; pc++) {
+			char *out = reserve(2);
+			out[0] = image[pc] & 0xff;
+			out[1] = image[pc] >> 8;
+			fill += 2;
+		}
+	}
+}
+
+void out_writer::close() {
+	switch (fmt) {
+	case outfmt_t::ram:
+		break;
+	case outfmt_t::raw_le:
+		write_raw(false);
+		break;
+	case outfmt_t::raw_be:
+		write_raw(true);
+		break;
+	case outfmt_t::ihex:
+		write_ihex();
+		break;
+	case outfmt_t::sparse:
+		write_sparse();
+		break;
+	}
+	flush();
+}
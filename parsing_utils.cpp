@@ -5,6 +5,15 @@
 #include <unordered_map>
 #include <fstream>
 #include <algorithm> // for transform
+#include <stdexcept>
+#include <string_view>
+#include <cctype> // for tolower
+#include <charconv> // for from_chars
+
+#include <fcntl.h> // for open
+#include <sys/mman.h> // for mmap
+#include <sys/stat.h> // for fstat
+#include <unistd.h> // for close
 
 #include "eepasm.h"
 
@@ -16,44 +25,63 @@ std::string get_low_str(std::istream& infile) {
 	return out;
 }
 
-std::unordered_map<std::string, std::string> reg_opgen(std::ifstream& cfile) {
-	std::unordered_map<std::string, std::string>  opfield_map;
+operand_t reg_opgen(std::istream& cfile) {
+	operand_t opd {optype_t::reg};
 
-	opfield_map["lsb"] = get_cfile_val(cfile, "lsb");
+	opd.lsb = field_parse(get_cfile_val(cfile, "lsb"), 16 - regsize);
+	opd.size = regsize;
+	opd.mask = (1 << regsize) - 1;
 
-	return opfield_map;
+	return opd;
 }
 
-std::unordered_map<std::string, std::string> imm_opgen(std::ifstream& cfile) {
-	std::unordered_map<std::string, std::string>  opfield_map;
+operand_t imm_opgen(std::istream& cfile) {
+	operand_t opd {optype_t::imm};
 
-	opfield_map["size"] = get_cfile_val(cfile, "size");
-	opfield_map["lsb"] = get_cfile_val(cfile, "lsb");
-	opfield_map["ins8"] = get_cfile_val(cfile, "ins8");
-	if (!(opfield_map["ins8"] == "0" || opfield_map["ins8"] == "1"))
+	opd.size = field_parse(get_cfile_val(cfile, "size"), 16);
+	opd.lsb = field_parse(get_cfile_val(cfile, "lsb"), 16 - opd.size);
+	opd.mask = (1 << opd.size) - 1;
+	std::string ins8 = get_cfile_val(cfile, "ins8");
+	if (!(ins8 == "0" || ins8 == "1"))
 		throw parsing_error {"ins8 value must be 0 or 1"};
+	opd.ins8 = (ins8 == "1") << 8;
 
-	return opfield_map;
+	return opd;
 }
 
-std::unordered_map<std::string, std::string> lit_opgen(std::ifstream& cfile) {
-	std::unordered_map<std::string, std::string>  opfield_map;
+operand_t lit_opgen(std::istream& cfile) {
+	operand_t opd {optype_t::lit};
 
-	opfield_map["name"] = get_cfile_val(cfile, "name");
-	opfield_map["const"] = get_cfile_val(cfile, "const");
+	opd.name = get_cfile_val(cfile, "name");
+	opd.lit_const = num_parse(get_cfile_val(cfile, "const"));
 
-	return opfield_map;
+	return opd;
 }
 
-std::unordered_map<std::string, std::string> no_opgen(std::ifstream& cfile) {
-	std::unordered_map<std::string, std::string>  opfield_map {};
+operand_t no_opgen(std::istream& cfile) {
+	operand_t opd {optype_t::label};
+
+	// label has no fields in config: always an 8 bit offset
+	opd.size = offset_size;
+	opd.mask = (1 << offset_size) - 1;
 
-	// empty opfield map
+	return opd;
+}
 
-	return opfield_map;
+// parse bit position or size field of an operand and check its range
+uint8_t field_parse(const std::string& instr, int max) {
+	int val;
+	try {
+		val = num_parse(instr);
+	} catch (const std::logic_error& err) {
+		throw parsing_error {"invalid number '" + instr + "'"};
+	}
+	if (val > max)
+		throw parsing_error {"field value " + instr + " out of range"};
+	return val;
 }
 
-std::string get_cfile_val(std::ifstream& cfile, const std::string& field_name) {
+std::string get_cfile_val(std::istream& cfile, const std::string& field_name) {
 	std::string instr = get_low_str(cfile);
 	if (instr != field_name)
 		throw parsing_error {"'" + field_name + "' field missing"};
@@ -61,81 +89,162 @@ std::string get_cfile_val(std::ifstream& cfile, const std::string& field_name) {
 	return instr;
 }
 
-bool reg_check(const std::string& op, std::unordered_map<std::string, std::string>& opmap) {
-	return op[0] == 'r';
+bool reg_check(std::string_view op) {
+	return op[0] == 'r' || op[0] == 'R';
 }
 
-bool imm_check(const std::string& op, std::unordered_map<std::string, std::string>& opmap) {
+bool imm_check(std::string_view op) {
 	return ((op[0] >= '0' && op[0] <= '9') || op[0] == '-');
 }
 
-bool label_check(const std::string& op, std::unordered_map<std::string, std::string>& opmap) {
-	return true;
+void line_strip(std::string& line) {
+	size_t comment_start = line.find("//");
+	if (comment_start != std::string::npos)
+		line.resize(comment_start);
+
+	size_t start = line.find_first_not_of(" \t\r");
+	if (start == std::string::npos) {
+		line.clear();
+		return;
+	}
+	line.resize(line.find_last_not_of(" \t\r") + 1);
+	line.erase(0, start);
+}
+
+source_error::source_error(int line, const std::string& msg)
+	: assem_error {"line " + std::to_string(line) + ": " + msg}, line {line}, col {1}, msg {msg} {}
+
+// split one source line into tokens: whitespace, ',', '#', '[' and ']'
+// separate tokens and '//' starts a comment (see scan.cpp)
+tokline_t scan_line(std::string_view line, int line_no) {
+	if (line.size() > UINT16_MAX)
+		throw source_error {line_no, "longer than " + std::to_string(UINT16_MAX) + " characters"};
+	tokline_t out;
+	out.text = line.data();
+	out.ins = nullptr;
+	out.line = line_no;
+	out.label_sym = 0;
+	out.ntok = 0;
+	out.region_start = false;
+	out.label_op = -1;
+	scan_tokens(line, out);
+	return out;
 }
 
-bool lit_check(const std::string& op, std::unordered_map<std::string, std::string>& opmap) {
-	return (op == opmap["name"]);
+bool ci_eq(std::string_view a, std::string_view b) {
+	if (a.size() != b.size())
+		return false;
+	for (size_t i = 0; i < a.size(); i++)
+		if (std::tolower(static_cast<unsigned char>(a[i])) != std::tolower(static_cast<unsigned char>(b[i])))
+			return false;
+	return true;
 }
 
-void line_strip(std::string& line) {
-	int comment_start = line.find("//");
-	if (comment_start != -1)
-		line = line.replace(comment_start, line.size()-1, "");
-
-	while (line[0] == '\t' || line[0] == ' ')
-		line = line.replace(0, 1, "");
-	while (line[line.size()-1] == '\t' || line[line.size()-1] == ' ')
-		line.resize(line.size()-1);
-}
-
-std::string ins2str(int pc, uint16_t iword) {
-	std::ostringstream out;
-	if (pc <= 0xf)
-		out << "0x0" << std::hex << pc << " ";
-	else
-		out << "0x" << std::hex << pc << " ";
-
-	if (iword <= 0xf)
-		out << "0x000" << std::hex << iword;
-	else if (iword <= 0xff)
-		out << "0x00" << std::hex << iword;
-	else if (iword <= 0xfff)
-		out << "0x0" << std::hex << iword;
-	else
-		out << "0x" << std::hex << iword;
-
-	return out.str();
-}
-
-uint16_t num_parse(const std::string& instr) {
-	uint16_t num;
-	if (instr.substr(0,2) == "0x")
-		num = std::stoi(instr.substr(2), nullptr, 16); // base 16
-	else if (instr.substr(0,2) == "0b")
-		num = std::stoi(instr.substr(2), nullptr, 2); // base 2
-	else
-		num = std::stoi(instr); // base 10
+size_t ci_hash::operator()(std::string_view str) const {
+	uint64_t hash = fnv_offset;
+	for (unsigned char c : str) {
+		hash ^= std::tolower(c);
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+bool ci_equal::operator()(std::string_view a, std::string_view b) const {
+	return ci_eq(a, b);
+}
+
+file_map::file_map(const std::string& path) {
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd == -1)
+		return;
+	struct stat st;
+	if (fstat(fd, &st) == 0) {
+		opened = true;
+		if (st.st_size > 0) {
+			void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (p != MAP_FAILED) {
+				addr = static_cast<const char *>(p);
+				len = st.st_size;
+			} else {
+				opened = false;
+			}
+		}
+	}
+	close(fd);
+}
+
+file_map::~file_map() {
+	if (addr)
+		munmap(const_cast<char *>(addr), len);
+}
+
+// decimal, 0x hex or 0b binary number with optional sign, read like stoi
+// (characters after the digits are ignored, invalid_argument without
+// digits, out_of_range beyond int) but without allocating, truncated to 16 bits
+uint16_t num_parse(std::string_view instr) {
+	int base = 10;
+	std::string_view prefix = instr.substr(0, 2);
+	if (ci_eq(prefix, "0x") || ci_eq(prefix, "0b")) {
+		base = ci_eq(prefix, "0x") ? 16 : 2;
+		instr.remove_prefix(2);
+	}
+	bool neg = !instr.empty() && instr[0] == '-';
+	if (!instr.empty() && (instr[0] == '-' || instr[0] == '+'))
+		instr.remove_prefix(1);
+	if (base == 16 && instr.size() > 2 && ci_eq(instr.substr(0, 2), "0x") && std::isxdigit(static_cast<unsigned char>(instr[2])))
+		instr.remove_prefix(2); // stoi takes the prefix after a sign too
+	unsigned long long num;
+	auto [end, ec] = std::from_chars(instr.data(), instr.data() + instr.size(), num, base);
+	if (ec == std::errc::invalid_argument)
+		throw std::invalid_argument {"num_parse"};
+	if (ec == std::errc::result_out_of_range || num > (neg ? 1ULL << 31 : (1ULL << 31) - 1))
+		throw std::out_of_range {"num_parse"};
+	return neg ? -num : num;
+}
+
+// thread count of -j: a decimal number from 1 to max_threads, nothing else
+unsigned threads_parse(std::string_view arg) {
+	unsigned num;
+	auto [end, ec] = std::from_chars(arg.data(), arg.data() + arg.size(), num);
+	if (arg.empty() || ec != std::errc {} || end != arg.data() + arg.size() || num == 0 || num > max_threads)
+		throw assem_error {"invalid thread count '" + std::string(arg) + "' (1 to " + std::to_string(max_threads) + ")"};
 	return num;
 }
 
-uint16_t reg_parse(const std::string& reg_name, std::unordered_map<std::string, std::string>& opfield_map, int pc) {
-	return (reg_name[1] - '0') << num_parse(opfield_map["lsb"]);
+uint16_t reg_parse(std::string_view reg_name, const operand_t& opd, int pc, const symtab_t& labels) {
+	return reg_num(reg_name) << opd.lsb;
 }
 
-uint16_t imm_parse(const std::string& imm_op, std::unordered_map<std::string, std::string>& opfield_map, int pc) {
-	uint16_t bitmask = (1 << num_parse(opfield_map["size"])) - 1;
+uint16_t imm_parse(std::string_view imm_op, const operand_t& opd, int pc, const symtab_t& labels) {
 	uint16_t num = num_parse(imm_op);
-	num = (num & bitmask) << num_parse(opfield_map["lsb"]);
-	num += (num_parse(opfield_map["ins8"]) << 8);
+	num = (num & opd.mask) << opd.lsb;
+	num += opd.ins8;
 	return num;
 }
 
-uint16_t label_parse(const std::string& label, std::unordered_map<std::string, std::string>& opfield_map, int pc) {
-	if (label_map.find(label) == label_map.end())
-		throw assem_error {"label '" + label + "' not found in program"};
-	return (label_map[label] - static_cast<uint16_t>(pc)) & 0xff;
+uint16_t label_parse(std::string_view label, const operand_t& opd, int pc, const symtab_t& labels) {
+	return label_encode(label, labels.value(label), pc);
+}
+
+// offset field to the label at address value (-1: undefined) from pc
+uint16_t label_encode(std::string_view label, int value, int pc) {
+	if (value < 0)
+		throw assem_error {"label '" + std::string {label} + "' not found in program"};
+	int offset = label_offset(value, pc);
+	if (offset < label_min || offset > label_max)
+		throw assem_error {"label '" + std::string {label} + "' out of reach (offset " + std::to_string(offset) + ")"};
+	return offset & 0xff;
+}
+
+uint16_t lit_parse(std::string_view label, const operand_t& opd, int pc, const symtab_t& labels) {
+	return opd.lit_const;
 }
 
-uint16_t lit_parse(const std::string& label, std::unordered_map<std::string, std::string>& opfield_map, int pc) {
-	return num_parse(opfield_map["const"]);
+// path with its file extension (if any) replaced by ext
+std::string replace_ext(const std::string& path, const std::string& ext) {
+	size_t dot = path.rfind('.');
+	size_t slash = path.rfind('/');
+	if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+		return path + ext;
+	return path.substr(0, dot) + ext;
 }
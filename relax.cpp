@@ -0,0 +1,228 @@
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <algorithm> // for lower_bound, upper_bound
+#include <stdexcept>
+#include <cstdint>
+
+#include "eepasm.h"
+
+// Branch relaxation: a label operand is a signed 8 bit offset from its
+// instruction, so an instruction with a long form in the ISA config whose
+// label is out of reach is replaced by the lines of its long form. Growing
+// one branch moves the labels after it, which may put other branches out of
+// reach. Branches are checked from a worklist: a grown branch only queues
+// the branches within reach of it, since only those can span it, and the
+// few to another org region or further away are checked again after every
+// round. Branches only grow, so every branch is grown at most once.
+
+namespace {
+
+// records a short branch can span at most
+constexpr size_t reach_records = label_max - label_min + 1;
+
+// words added by grown records before an index (Fenwick tree)
+class grown_words_t {
+public:
+	explicit grown_words_t(size_t n) : tree(n + 1) {}
+	void add(size_t idx, int words) {
+		for (idx++; idx < tree.size(); idx += idx & -idx)
+			tree[idx] += words;
+	}
+	long before(size_t idx) const {
+		long sum = 0;
+		for (; idx > 0; idx -= idx & -idx)
+			sum += tree[idx];
+		return sum;
+	}
+private:
+	std::vector<long> tree;
+};
+
+struct branch_t {
+	size_t rec; // index in tok_vec
+	size_t target; // index the label precedes
+	bool far; // in another org region or further than reach_records
+	bool grown = false;
+	bool queued = true;
+};
+
+// pcs of the records while branches grow
+class layout_t {
+public:
+	explicit layout_t(const tokvec_t& tok_vec) : last_org(tok_vec.size() + 1, -1), org_pc(tok_vec.size()), grown(tok_vec.size()) {
+		for (size_t i = 0; i < tok_vec.size(); i++) {
+			last_org[i + 1] = last_org[i];
+			if (is_org(tok_vec[i])) {
+				org_pc[i] = org_parse(tok_vec[i]);
+				last_org[i + 1] = i;
+			}
+		}
+	}
+	// pc at index idx, before the record there
+	int pc(size_t idx) const {
+		int org = last_org[idx];
+		size_t first = org + 1;
+		return (org < 0 ? 0 : org_pc[org]) + (idx - first) + grown.before(idx) - grown.before(first);
+	}
+	int region(size_t idx) const { return last_org[idx]; }
+	void grow(size_t idx, int words) { grown.add(idx, words); }
+private:
+	std::vector<int> last_org; // index of the last org record before every index, -1 if none
+	std::vector<int> org_pc; // address of every org record
+	grown_words_t grown;
+};
+
+// line of a long form with %ins (the mnemonic), %hi and %lo (bytes of the
+// offset from the last line of the long form to the label), %ahi and %alo
+// (bytes of the address of the label) filled in
+std::string long_line(const std::string& form, std::string_view ins, int offset, int addr) {
+	std::string out;
+	for (size_t i = 0; i < form.size(); i++) {
+		if (form[i] != '%') {
+			out += form[i];
+			continue;
+		}
+		std::string_view rest = std::string_view {form}.substr(i + 1);
+		auto field = [&](std::string_view name) {
+			return ci_eq(rest.substr(0, name.size()), name);
+		};
+		int byte;
+		if (field("ins")) {
+			out += ins;
+			i += 3;
+			continue;
+		} else if (field("ahi") || field("alo")) {
+			byte = field("ahi") ? addr >> 8 : addr;
+			i += 3;
+		} else if (field("hi") || field("lo")) {
+			byte = field("hi") ? offset >> 8 : offset;
+			i += 2;
+		} else {
+			throw assem_error {"unknown field in long form '" + form + "'"};
+		}
+		char digits[2];
+		put_hex(digits, byte & 0xff, 2);
+		out += "0x";
+		out.append(digits, 2);
+	}
+	return out;
+}
+
+}
+
+// replace every branch out of reach whose instruction has a long form, and
+// move the labels after it. The lines of the long forms are kept in text,
+// which has to outlive tok_vec. Their lookups are counted in stats if given.
+void relax(const insmap_t& insmap, tokvec_t& tok_vec, symtab_t& labels, std::string& text, asm_stats_t *stats) {
+	std::vector<branch_t> branches;
+	std::vector<size_t> branch_recs; // rec of every branch, ascending
+	layout_t layout {tok_vec};
+	for (size_t i = 0; i < tok_vec.size(); i++) {
+		const tokline_t& tokens = tok_vec[i];
+		if (tokens.label_op < 0 || !tokens.ins || tokens.ins->long_form.empty())
+			continue;
+		const symbol_t& sym = labels.syms[tokens.label_sym];
+		if (sym.value < 0 || sym.index < 0)
+			continue;
+		size_t target = sym.index;
+		bool far = layout.region(i) != layout.region(target) || (i > target ? i - target : target - i) > reach_records;
+		branches.push_back({i, target, far});
+		branch_recs.push_back(i);
+	}
+	if (branches.empty())
+		return;
+
+	auto in_reach = [&](const branch_t& br) {
+		int offset = label_offset(layout.pc(br.target), layout.pc(br.rec));
+		return offset >= label_min && offset <= label_max;
+	};
+
+	std::vector<size_t> work;
+	for (size_t b = branches.size(); b-- > 0;)
+		work.push_back(b);
+	bool any_grown = false;
+	while (!work.empty()) {
+		bool round_grown = false;
+		while (!work.empty()) {
+			branch_t& br = branches[work.back()];
+			work.pop_back();
+			br.queued = false;
+			if (br.grown || in_reach(br))
+				continue;
+			br.grown = true;
+			round_grown = true;
+			layout.grow(br.rec, tok_vec[br.rec].ins->long_form.size() - 1);
+			auto near = std::lower_bound(branch_recs.begin(), branch_recs.end(), br.rec - std::min(br.rec, reach_records));
+			auto near_end = std::upper_bound(branch_recs.begin(), branch_recs.end(), br.rec + reach_records);
+			for (; near != near_end; near++) {
+				branch_t& other = branches[near - branch_recs.begin()];
+				if (!other.grown && !other.queued && !other.far) {
+					other.queued = true;
+					work.push_back(near - branch_recs.begin());
+				}
+			}
+		}
+		if (!round_grown)
+			break;
+		any_grown = true;
+		for (size_t b = 0; b < branches.size(); b++) {
+			if (branches[b].far && !branches[b].grown) {
+				branches[b].queued = true;
+				work.push_back(b);
+			}
+		}
+	}
+	if (!any_grown)
+		return;
+
+	for (auto& sym : labels.syms)
+		if (sym.value >= 0 && sym.index >= 0)
+			sym.value = layout.pc(sym.index);
+
+	// all lines first: text must not move once records point into it
+	std::vector<size_t> line_starts;
+	for (const auto& br : branches) {
+		if (!br.grown)
+			continue;
+		const tokline_t& tokens = tok_vec[br.rec];
+		const auto& form = tokens.ins->long_form;
+		int addr = layout.pc(br.target);
+		int offset = addr - (layout.pc(br.rec) + static_cast<int>(form.size()) - 1);
+		for (const auto& line : form) {
+			line_starts.push_back(text.size());
+			try {
+				text += long_line(line, tokens.tok(0), offset, addr);
+			} catch (const assem_error& err) {
+				throw source_error {tokens, err.what()};
+			}
+			text += '\n';
+		}
+	}
+
+	tokvec_t out;
+	out.reserve(tok_vec.size() + line_starts.size());
+	size_t line_idx = 0;
+	size_t next = 0; // record after the last grown branch
+	for (const auto& br : branches) {
+		if (!br.grown)
+			continue;
+		out.insert(out.end(), tok_vec.begin() + next, tok_vec.begin() + br.rec);
+		next = br.rec + 1;
+		const tokline_t& tokens = tok_vec[br.rec];
+		for (size_t k = 0; k < tokens.ins->long_form.size(); k++, line_idx++) {
+			size_t start = line_starts[line_idx];
+			std::string_view line {text.data() + start, text.find('\n', start) - start};
+			tokline_t long_tokens = scan_line(line, tokens.line);
+			if (long_tokens.ntok > 0)
+				long_tokens.ins = insmap.lookup(long_tokens.tok(0), stats);
+			if (!long_tokens.ins)
+				throw source_error {tokens, "no instruction in long form line '" + std::string {line} + "'"};
+			long_tokens.region_start = k == 0 && tokens.region_start;
+			out.push_back(long_tokens);
+		}
+	}
+	out.insert(out.end(), tok_vec.begin() + next, tok_vec.end());
+	tok_vec = std::move(out);
+}
@@ -0,0 +1,233 @@
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <array>
+#include <stdexcept>
+#include <cstdint>
+#include <algorithm> // for min
+#include <cstring> // for memcpy, memset
+#include <bit> // for countr_zero
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "eepasm.h"
+
+// Token scanners of scan_line, all with the same result: whitespace, ',',
+// '#', '[' and ']' separate tokens and the first "//" ends the line. The
+// scalar one looks at one byte at a time, the SIMD ones classify 16 (SSE2)
+// or 32 (AVX2) bytes at once into a mask of token bytes, cut it at the
+// first comment and take the token boundaries from the changes in the mask.
+// The widest one the CPU has is used.
+
+namespace {
+
+// character classes of the scalar scanner: everything else is part of a token
+enum char_class_t : uint8_t { ch_token, ch_delim, ch_slash };
+
+constexpr auto char_classes = [] {
+	std::array<uint8_t, 256> table {};
+	for (unsigned char c : {' ', '\t', '\r', '\n', '\v', '\f', ',', '#', '[', ']'})
+		table[c] = ch_delim;
+	table['/'] = ch_slash;
+	return table;
+}();
+
+void tok_add(tokline_t& out, size_t start, size_t end) {
+	if (out.ntok < max_line_toks)
+		out.tokens[out.ntok] = {static_cast<uint16_t>(start), static_cast<uint16_t>(end - start)};
+	out.ntok++;
+}
+
+void scan_scalar(std::string_view line, tokline_t& out) {
+	size_t i = 0, len = line.size();
+	while (i < len) {
+		uint8_t cls = char_classes[static_cast<unsigned char>(line[i])];
+		if (cls == ch_delim) {
+			i++;
+			continue;
+		}
+		if (cls == ch_slash && i + 1 < len && line[i + 1] == '/')
+			break;
+
+		size_t start = i;
+		for (i++; i < len; i++) {
+			cls = char_classes[static_cast<unsigned char>(line[i])];
+			if (cls == ch_delim || (cls == ch_slash && i + 1 < len && line[i + 1] == '/'))
+				break;
+		}
+		tok_add(out, start, i);
+	}
+}
+
+// tokens from the masks of consecutive blocks of width bytes: bit i of a
+// mask is set if byte i of the block is part of a token, a token may go on
+// in the next block
+template<size_t width>
+class mask_scan_t {
+public:
+	void block(uint32_t tok, size_t off, tokline_t& out) {
+		uint32_t changes = (tok ^ ((tok << 1) | in_tok)) & (~0u >> (32 - width));
+		for (; changes; changes &= changes - 1) {
+			size_t pos = off + std::countr_zero(changes);
+			if (in_tok)
+				tok_add(out, start, pos);
+			else
+				start = pos;
+			in_tok = !in_tok;
+		}
+	}
+	void finish(size_t end, tokline_t& out) {
+		if (in_tok)
+			tok_add(out, start, end);
+	}
+private:
+	bool in_tok = false;
+	size_t start = 0;
+};
+
+#if defined(__x86_64__)
+
+// the block at off, or a copy padded with spaces if it is the last one:
+// one byte more than the block is read to find comments across blocks
+template<size_t width>
+const char *block_at(std::string_view line, size_t off, char (&pad)[width + 1]) {
+	if (off + width + 1 <= line.size())
+		return line.data() + off;
+	std::memset(pad, ' ', sizeof(pad));
+	std::memcpy(pad, line.data() + off, line.size() - off);
+	return pad;
+}
+
+uint32_t delims_sse2(__m128i v) {
+	// '\t', '\n', '\v', '\f' and '\r' are 9 to 13
+	__m128i ctl = _mm_sub_epi8(v, _mm_set1_epi8(9));
+	__m128i out = _mm_cmpeq_epi8(_mm_min_epu8(ctl, _mm_set1_epi8(4)), ctl);
+	for (char c : {' ', ',', '#', '[', ']'})
+		out = _mm_or_si128(out, _mm_cmpeq_epi8(v, _mm_set1_epi8(c)));
+	return _mm_movemask_epi8(out);
+}
+
+void scan_sse2(std::string_view line, tokline_t& out) {
+	constexpr size_t width = 16;
+	char pad[width + 1];
+	mask_scan_t<width> scan;
+	for (size_t off = 0; off < line.size(); off += width) {
+		const char *p = block_at<width>(line, off, pad);
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+		__m128i next = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 1));
+		__m128i slash = _mm_set1_epi8('/');
+		uint32_t comment = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(v, slash), _mm_cmpeq_epi8(next, slash)));
+		uint32_t tok = ~delims_sse2(v) & 0xffff;
+		if (comment) {
+			int end = std::countr_zero(comment);
+			scan.block(tok & ((1u << end) - 1), off, out);
+			scan.finish(off + end, out);
+			return;
+		}
+		scan.block(tok, off, out);
+	}
+	scan.finish(line.size(), out);
+}
+
+__attribute__((target("avx2")))
+uint32_t delims_avx2(__m256i v) {
+	__m256i ctl = _mm256_sub_epi8(v, _mm256_set1_epi8(9));
+	__m256i out = _mm256_cmpeq_epi8(_mm256_min_epu8(ctl, _mm256_set1_epi8(4)), ctl);
+	for (char c : {' ', ',', '#', '[', ']'})
+		out = _mm256_or_si256(out, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(c)));
+	return _mm256_movemask_epi8(out);
+}
+
+__attribute__((target("avx2")))
+void scan_avx2(std::string_view line, tokline_t& out) {
+	constexpr size_t width = 32;
+	char pad[width + 1];
+	mask_scan_t<width> scan;
+	for (size_t off = 0; off < line.size(); off += width) {
+		const char *p = block_at<width>(line, off, pad);
+		__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+		__m256i next = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 1));
+		__m256i slash = _mm256_set1_epi8('/');
+		uint32_t comment = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(v, slash), _mm256_cmpeq_epi8(next, slash)));
+		uint32_t tok = ~delims_avx2(v);
+		if (comment) {
+			int end = std::countr_zero(comment);
+			scan.block(tok & ((1u << end) - 1), off, out);
+			scan.finish(off + end, out);
+			return;
+		}
+		scan.block(tok, off, out);
+	}
+	scan.finish(line.size(), out);
+}
+
+#endif
+
+}
+
+// scanners usable on this CPU, the scalar one first and the widest last
+const std::vector<scanner_t>& scanners() {
+	static const std::vector<scanner_t> list = [] {
+		std::vector<scanner_t> out {{"scalar", scan_scalar}};
+#if defined(__x86_64__)
+		out.push_back({"sse2", scan_sse2});
+		if (__builtin_cpu_supports("avx2"))
+			out.push_back({"avx2", scan_avx2});
+#endif
+		return out;
+	}();
+	return list;
+}
+
+void scan_tokens(std::string_view line, tokline_t& out) {
+	static const auto scan = scanners().back().fn;
+	scan(line, out);
+}
+
+// scan every line of src with every scanner and compare with the scalar one,
+// also the line without its first 1 to 63 bytes to test all offsets into
+// the blocks; the first difference is reported on out
+bool scanners_check(std::string_view src, std::ostream& out) {
+	const auto& list = scanners();
+	auto same = [](const tokline_t& a, const tokline_t& b) {
+		if (a.ntok != b.ntok)
+			return false;
+		for (int i = 0; i < std::min<int>(a.ntok, max_line_toks); i++)
+			if (a.tokens[i].off != b.tokens[i].off || a.tokens[i].len != b.tokens[i].len)
+				return false;
+		return true;
+	};
+	int line_no = 0;
+	size_t lines = 0;
+	for (size_t pos = 0; pos < src.size();) {
+		size_t line_end = std::min(src.find('\n', pos), src.size());
+		std::string_view line = src.substr(pos, line_end - pos);
+		pos = line_end + 1;
+		line_no++;
+		for (size_t skip = 0; skip < std::min<size_t>(line.size(), 64) || skip == 0; skip++) {
+			std::string_view part = line.substr(skip);
+			tokline_t ref = scan_line(part, line_no);
+			ref.ntok = 0;
+			scan_scalar(part, ref);
+			for (const auto& [name, fn] : list) {
+				tokline_t tokens = ref;
+				tokens.ntok = 0;
+				fn(part, tokens);
+				if (!same(ref, tokens)) {
+					out << "line " << line_no << ", from column " << skip + 1 << ": " << name << " scanner differs from scalar\n";
+					return false;
+				}
+			}
+			lines++;
+		}
+	}
+	out << lines << " lines scanned alike by";
+	for (const auto& scanner : list)
+		out << ' ' << scanner.name;
+	out << '\n';
+	return true;
+}
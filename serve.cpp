@@ -0,0 +1,341 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <memory> // for shared_ptr
+#include <mutex>
+#include <algorithm> // for clamp
+#include <iterator> // for istreambuf_iterator
+#include <chrono>
+#include <stdexcept>
+#include <cerrno>
+#include <climits> // for PATH_MAX
+#include <cstdint>
+#include <cstring>
+
+#include <sched.h> // for unshare
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "eepasm.h"
+#include "module_cache.h"
+#include "bin_io.h"
+#include "thread_pool.h"
+
+// Assembler daemon (--serve) and its client (--connect). A request carries
+// one job_t exactly as the client parsed it from its command line together
+// with the client's working directory and umask, which the worker takes
+// over (Linux per-thread filesystem attributes), so paths and messages are
+// the same as when assembling in the client. Input from stdin is sent with
+// the request and the client's stdout is passed as a file descriptor for
+// output to "-". The reply is the exit status and what the job wrote to
+// stderr.
+//
+// messages: length (u32) followed by
+//   request: magic "EEPQ", version (u32), working directory, umask (u32),
+//            config, input, output, cache dir, symbol file (u32 length + bytes each),
+//            format, stream, stats format, object (u8 each), encoding threads (u32),
+//            stdin data (u32 length + bytes);
+//            the client's stdout comes as SCM_RIGHTS with the first byte
+//   reply: exit status (u8), stderr text (u32 length + bytes)
+
+constexpr char req_magic[4] = {'E', 'E', 'P', 'Q'};
+constexpr uint32_t req_version = 4;
+constexpr uint32_t max_msg_size = 1u << 30;
+
+sockaddr_un sock_addr(const std::string& sock_path) {
+	sockaddr_un addr {};
+	addr.sun_family = AF_UNIX;
+	if (sock_path.size() >= sizeof(addr.sun_path))
+		error("socket path '" + sock_path + "' too long");
+	std::memcpy(addr.sun_path, sock_path.c_str(), sock_path.size() + 1);
+	return addr;
+}
+
+bool send_all(int fd, const char *data, size_t len) {
+	while (len > 0) {
+		ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+		if (n <= 0)
+			return false;
+		data += n;
+		len -= n;
+	}
+	return true;
+}
+
+bool recv_all(int fd, char *data, size_t len) {
+	while (len > 0) {
+		ssize_t n = recv(fd, data, len, 0);
+		if (n <= 0)
+			return false;
+		data += n;
+		len -= n;
+	}
+	return true;
+}
+
+// message with pass_fd (if not -1) attached to its first byte
+bool send_msg(int fd, const std::string& payload, int pass_fd = -1) {
+	std::string buf;
+	put<uint32_t>(buf, payload.size());
+	buf += payload;
+
+	size_t sent = 0;
+	if (pass_fd != -1) {
+		iovec iov {buf.data(), 1};
+		char ctrl[CMSG_SPACE(sizeof(int))] {};
+		msghdr msg {};
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = ctrl;
+		msg.msg_controllen = sizeof(ctrl);
+		cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		std::memcpy(CMSG_DATA(cmsg), &pass_fd, sizeof(int));
+		if (sendmsg(fd, &msg, MSG_NOSIGNAL) != 1)
+			return false;
+		sent = 1;
+	}
+	return send_all(fd, buf.data() + sent, buf.size() - sent);
+}
+
+// message into payload and the descriptor passed with it into passed_fd
+// (-1 if none)
+bool recv_msg(int fd, std::string& payload, int *passed_fd = nullptr) {
+	char len_buf[sizeof(uint32_t)];
+	iovec iov {len_buf, 1};
+	char ctrl[CMSG_SPACE(sizeof(int))] {};
+	msghdr msg {};
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = ctrl;
+	msg.msg_controllen = sizeof(ctrl);
+	if (recvmsg(fd, &msg, MSG_CMSG_CLOEXEC) != 1)
+		return false;
+	if (passed_fd) {
+		*passed_fd = -1;
+		for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+			if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+				std::memcpy(passed_fd, CMSG_DATA(cmsg), sizeof(int));
+	}
+
+	uint32_t len;
+	if (!recv_all(fd, len_buf + 1, sizeof(len_buf) - 1))
+		return false;
+	std::memcpy(&len, len_buf, sizeof(len));
+	if (len > max_msg_size)
+		return false;
+	payload.resize(len);
+	return recv_all(fd, payload.data(), len);
+}
+
+// parsed ISAs shared by all requests by absolute config path; an entry is
+// loaded again once the modification time or size of its file changes
+class isa_store {
+public:
+	struct entry_t {
+		std::shared_ptr<const insmap_t> insmap;
+		std::shared_ptr<module_cache_t> modules; // included files lexed for insmap
+		uint64_t hash = 0; // of the config source, part of --cache-dir keys
+		timespec mtime {};
+		off_t size = 0;
+	};
+
+	isa_store() {
+		builtin.insmap = std::make_shared<const insmap_t>(isa_open(""));
+		builtin.modules = std::make_shared<module_cache_t>();
+		builtin.hash = builtin_isa_hash();
+	}
+
+	// conf_file relative to the calling thread's working directory cwd;
+	// throws parsing_error
+	entry_t get(const std::string& conf_file, const std::string& cwd) {
+		if (conf_file == "")
+			return builtin;
+		struct stat st;
+		if (stat(conf_file.c_str(), &st) != 0)
+			throw parsing_error {"Can't open instruction list config file '" + conf_file + "'"};
+		std::string key = conf_file[0] == '/' ? conf_file : cwd + "/" + conf_file;
+
+		std::lock_guard<std::mutex> guard {lock};
+		entry_t& entry = entries[key];
+		if (entry.insmap && entry.size == st.st_size && entry.mtime.tv_sec == st.st_mtim.tv_sec
+				&& entry.mtime.tv_nsec == st.st_mtim.tv_nsec)
+			return entry;
+
+		insmap_t insmap = isa_read(conf_file);
+		encoders_attach(insmap);
+		file_map src {conf_file};
+		entry.insmap = std::make_shared<const insmap_t>(std::move(insmap));
+		entry.modules = std::make_shared<module_cache_t>();
+		entry.hash = fnv1a_hash(src.data(), src.size());
+		entry.mtime = st.st_mtim;
+		entry.size = st.st_size;
+		return entry;
+	}
+
+private:
+	entry_t builtin;
+	std::mutex lock;
+	std::unordered_map<std::string, entry_t> entries;
+};
+
+// one request on connection conn, run by a worker of the pool
+void serve_conn(isa_store& isas, int conn) {
+	std::string req;
+	int out_fd = -1;
+	if (!recv_msg(conn, req, &out_fd)) {
+		if (out_fd != -1)
+			close(out_fd);
+		return;
+	}
+
+	std::ostringstream err;
+	int status = 0;
+	try {
+		auto start = std::chrono::steady_clock::now();
+		bin_reader in {req.data(), req.size()};
+		for (char c : req_magic)
+			if (in.get<char>() != c)
+				throw parsing_error {"not an eepasm request"};
+		if (in.get<uint32_t>() != req_version)
+			throw parsing_error {"client and server versions differ"};
+		std::string cwd = in.get_str<uint32_t>();
+		mode_t mask = in.get<uint32_t>();
+		job_t job;
+		job.insfile = in.get_str<uint32_t>();
+		job.infile_name = in.get_str<uint32_t>();
+		job.outfile_name = in.get_str<uint32_t>();
+		job.opts.cache_dir = in.get_str<uint32_t>();
+		job.opts.sym_file = in.get_str<uint32_t>();
+		uint8_t fmt = in.get<uint8_t>();
+		if (fmt > static_cast<uint8_t>(outfmt_t::sparse))
+			throw parsing_error {"invalid output format in request"};
+		job.opts.fmt = static_cast<outfmt_t>(fmt);
+		job.stream = in.get<uint8_t>();
+		job.stats_fmt = in.get<uint8_t>();
+		job.opts.object = in.get<uint8_t>();
+		job.opts.threads = std::clamp(in.get<uint32_t>(), 1u, max_threads); // as the client resolved -j
+		std::istringstream stdin_data {in.get_str<uint32_t>()};
+		if (out_fd == -1)
+			throw parsing_error {"request without output descriptor"};
+
+		// working directory and umask of this thread only
+		if (unshare(CLONE_FS) != 0 || chdir(cwd.c_str()) != 0)
+			throw assem_error {"can't change to directory '" + cwd + "'"};
+		umask(mask);
+
+		asm_stats_t stats;
+		isa_store::entry_t isa = isas.get(job.insfile, cwd);
+		stats.config = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		job.opts.isa_hash = isa.hash;
+		job.opts.out_fd = out_fd;
+		job.opts.log = &err;
+		job.opts.modules = isa.modules.get();
+		job_run(*isa.insmap, job, stdin_data, err, stats);
+	} catch (const std::exception& e) {
+		err << "Error: " << e.what() << "\n";
+		status = EXIT_FAILURE;
+	}
+	if (out_fd != -1)
+		close(out_fd);
+
+	std::string reply;
+	put<uint8_t>(reply, status);
+	put_str<uint32_t>(reply, err.str());
+	send_msg(conn, reply);
+}
+
+// accept requests on sock_path until killed, nthreads workers (0: one per core)
+int serve(const std::string& sock_path, unsigned nthreads) {
+	signal(SIGPIPE, SIG_IGN); // clients may go away at any time
+	sockaddr_un addr = sock_addr(sock_path);
+	int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (listen_fd == -1)
+		error("can't create socket");
+
+	// replace the socket file of a server which is gone, never a live one
+	if (connect(listen_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0)
+		error("a server is already listening on '" + sock_path + "'");
+	close(listen_fd);
+	unlink(sock_path.c_str());
+	listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (listen_fd == -1 || bind(listen_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0
+			|| listen(listen_fd, SOMAXCONN) != 0)
+		error("can't listen on '" + sock_path + "'");
+
+	isa_store isas;
+	thread_pool pool {nthreads};
+	while (true) {
+		int conn = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+		if (conn == -1) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			error("accept on '" + sock_path + "' failed");
+		}
+		pool.submit([&isas, conn] {
+			serve_conn(isas, conn);
+			close(conn);
+		});
+	}
+}
+
+// run job on the server listening on sock_path: false if there is none,
+// else the exit status of the job is in status
+bool serve_client(const std::string& sock_path, const job_t& job, int& status) {
+	sockaddr_un addr = sock_addr(sock_path);
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd == -1)
+		return false;
+	if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+		close(fd);
+		return false;
+	}
+
+	char cwd[PATH_MAX];
+	if (!getcwd(cwd, sizeof(cwd)))
+		error("can't get the working directory");
+	mode_t mask = umask(0);
+	umask(mask);
+
+	std::string req;
+	req.append(req_magic, sizeof(req_magic));
+	put<uint32_t>(req, req_version);
+	put_str<uint32_t>(req, cwd);
+	put<uint32_t>(req, mask);
+	put_str<uint32_t>(req, job.insfile);
+	put_str<uint32_t>(req, job.infile_name);
+	put_str<uint32_t>(req, job.outfile_name);
+	put_str<uint32_t>(req, job.opts.cache_dir);
+	put_str<uint32_t>(req, job.opts.sym_file);
+	put<uint8_t>(req, static_cast<uint8_t>(job.opts.fmt));
+	put<uint8_t>(req, job.stream);
+	put<uint8_t>(req, job.stats_fmt);
+	put<uint8_t>(req, job.opts.object);
+	put<uint32_t>(req, job.opts.threads);
+	std::string stdin_data;
+	if (job.infile_name == "-")
+		stdin_data.assign(std::istreambuf_iterator<char> {std::cin}, {});
+	put_str<uint32_t>(req, stdin_data);
+
+	std::string reply;
+	if (!send_msg(fd, req, STDOUT_FILENO) || !recv_msg(fd, reply))
+		error("lost connection to server on '" + sock_path + "'");
+	close(fd);
+
+	try {
+		bin_reader in {reply.data(), reply.size()};
+		status = in.get<uint8_t>();
+		std::cerr << in.get_str<uint32_t>() << std::flush;
+	} catch (const parsing_error& err) {
+		error("invalid reply from server on '" + sock_path + "'");
+	}
+	return true;
+}
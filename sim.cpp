@@ -0,0 +1,290 @@
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm> // for fill
+#include <stdexcept>
+#include <cstdint>
+
+#include "sim.h"
+
+// Semantics are attached to the instructions of the config by mnemonic, the
+// encodings (and so the decoding) come from the config itself. Register
+// operands are taken in assembly order: "ADD Rc, Ra, Rb" is Rc := Ra + Rb,
+// with 2 registers the first one is result and first source.
+
+enum sim_op : uint8_t {
+	op_end, op_invalid, op_unsupported,
+	op_mov_r, op_add_r, op_sub_r, op_adc_r, op_sbc_r, op_and_r, op_cmp_r,
+	op_mov_i, op_add_i, op_sub_i, op_adc_i, op_sbc_i, op_and_i, op_cmp_i,
+	op_lsl, op_lsr, op_asr, op_xsr,
+	op_ldr_r, op_ldr_d, op_str_r, op_str_d,
+	op_jmp, op_noop, op_jeq, op_jne, op_jcs, op_jcc, op_jmi, op_jpl,
+	op_jge, op_jlt, op_jgt, op_jle, op_jhi, op_jls, op_jsr, op_ret,
+	op_ext,
+	num_sim_ops
+};
+
+constexpr int num_alu_ops = op_mov_i - op_mov_r;
+
+enum sem_kind { sem_alu, sem_shift, sem_ldr, sem_str, sem_jump, sem_ret, sem_ext };
+
+struct sem_t {
+	sem_kind kind;
+	uint8_t op; // register form for ALU instructions
+};
+
+const std::unordered_map<std::string, sem_t, ci_hash, ci_equal> semantics {
+	{"mov", {sem_alu, op_mov_r}}, {"add", {sem_alu, op_add_r}}, {"sub", {sem_alu, op_sub_r}},
+	{"adc", {sem_alu, op_adc_r}}, {"sbc", {sem_alu, op_sbc_r}}, {"and", {sem_alu, op_and_r}},
+	{"cmp", {sem_alu, op_cmp_r}},
+	{"lsl", {sem_shift, op_lsl}}, {"lsr", {sem_shift, op_lsr}}, {"asr", {sem_shift, op_asr}},
+	{"xsr", {sem_shift, op_xsr}},
+	{"ldr", {sem_ldr, op_ldr_r}}, {"str", {sem_str, op_str_r}},
+	{"jmp", {sem_jump, op_jmp}}, {"noop", {sem_jump, op_noop}}, {"jeq", {sem_jump, op_jeq}},
+	{"jne", {sem_jump, op_jne}}, {"jcs", {sem_jump, op_jcs}}, {"jcc", {sem_jump, op_jcc}},
+	{"jmi", {sem_jump, op_jmi}}, {"jpl", {sem_jump, op_jpl}}, {"jge", {sem_jump, op_jge}},
+	{"jlt", {sem_jump, op_jlt}}, {"jgt", {sem_jump, op_jgt}}, {"jle", {sem_jump, op_jle}},
+	{"jhi", {sem_jump, op_jhi}}, {"jls", {sem_jump, op_jls}}, {"jsr", {sem_jump, op_jsr}},
+	{"ret", {sem_ret, op_ret}},
+	{"ext", {sem_ext, op_ext}},
+};
+
+sim_ins_t sim_decode(const altdec_t *dec, uint16_t iword) {
+	sim_ins_t ins;
+	if (!dec) {
+		ins.op = op_invalid;
+		return ins;
+	}
+	ins.op = op_unsupported;
+	auto sem_it = semantics.find(*dec->name);
+	if (sem_it == semantics.end())
+		return ins;
+	const sem_t& sem = sem_it->second;
+
+	uint8_t regs[max_ops];
+	int nregs = 0;
+	bool has_imm = false;
+	for (const auto& opd : dec->ins->alts[dec->alt]) {
+		switch (opd.type) {
+		case optype_t::reg:
+			regs[nregs++] = field_get(iword, opd, false);
+			break;
+		case optype_t::imm:
+		case optype_t::label:
+			has_imm = true;
+			ins.imm = field_get(iword, opd, sem.kind != sem_ext);
+			ins.imm8 = opd.size == 8;
+			break;
+		case optype_t::lit:
+			return ins; // special registers are not simulated
+		}
+	}
+
+	switch (sem.kind) {
+	case sem_alu:
+		if (has_imm && nregs == 1) {
+			ins.op = sem.op + num_alu_ops;
+			ins.d = ins.x = regs[0];
+		} else if (!has_imm && nregs == 3) {
+			ins.op = sem.op;
+			ins.d = regs[0];
+			ins.x = regs[1];
+			ins.y = regs[2];
+		} else if (!has_imm && nregs == 2) {
+			ins.op = sem.op;
+			ins.d = ins.x = regs[0];
+			ins.y = regs[1];
+		}
+		break;
+	case sem_shift:
+		if (has_imm && nregs == 2) {
+			ins.op = sem.op;
+			ins.d = regs[0];
+			ins.x = regs[1];
+		}
+		break;
+	case sem_ldr:
+	case sem_str:
+		// register offset (offset may be left out) or direct addressing
+		if (nregs == 2) {
+			ins.op = sem.op;
+			ins.d = regs[0];
+			ins.x = regs[1];
+		} else if (nregs == 1 && has_imm) {
+			ins.op = sem.op + 1;
+			ins.d = regs[0];
+		}
+		break;
+	case sem_jump:
+		if (has_imm && nregs == 0)
+			ins.op = sem.op;
+		break;
+	case sem_ret:
+	case sem_ext:
+		if (nregs == 0)
+			ins.op = sem.op;
+		break;
+	}
+	return ins;
+}
+
+simulator::simulator(const insmap_t& insmap, const mem_image_t& image) : code(sim_mem_size) {
+	std::vector<altdec_t> decoders = alt_decoders(insmap);
+	for (int pc = 0; pc < sim_mem_size; pc++)
+		if (image.used[pc])
+			code[pc] = sim_decode(alt_decode(decoders, image.words[pc]), image.words[pc]);
+}
+
+void sim_state_t::reset() {
+	std::fill(reg, reg + 8, 0);
+	pc = 0;
+	n = z = c = v = false;
+	steps = 0;
+	std::fill(mem.begin(), mem.end(), 0);
+}
+
+// a + b + carry_in setting all flags; b is already inverted for subtraction
+static inline uint16_t add_flags(uint16_t a, uint16_t b, unsigned carry_in, bool& n, bool& z, bool& c, bool& v) {
+	uint32_t res = a + b + carry_in;
+	n = (res >> 15) & 1;
+	z = (res & 0xffff) == 0;
+	c = res >> 16;
+	v = (((a ^ res) & (b ^ res)) >> 15) & 1;
+	return res;
+}
+
+sim_stop_t simulator::run(sim_state_t& state, uint64_t max_steps) const {
+	// in the order of sim_op
+	static const void *const dispatch[] = {
+		&&do_end, &&do_invalid, &&do_unsupported,
+		&&do_mov_r, &&do_add_r, &&do_sub_r, &&do_adc_r, &&do_sbc_r, &&do_and_r, &&do_cmp_r,
+		&&do_mov_i, &&do_add_i, &&do_sub_i, &&do_adc_i, &&do_sbc_i, &&do_and_i, &&do_cmp_i,
+		&&do_lsl, &&do_lsr, &&do_asr, &&do_xsr,
+		&&do_ldr_r, &&do_ldr_d, &&do_str_r, &&do_str_d,
+		&&do_jmp, &&do_noop, &&do_jeq, &&do_jne, &&do_jcs, &&do_jcc, &&do_jmi, &&do_jpl,
+		&&do_jge, &&do_jlt, &&do_jgt, &&do_jle, &&do_jhi, &&do_jls, &&do_jsr, &&do_ret,
+		&&do_ext,
+	};
+	static_assert(sizeof(dispatch) / sizeof(dispatch[0]) == num_sim_ops);
+
+	const sim_ins_t *code = this->code.data();
+	uint16_t *r = state.reg;
+	uint16_t *mem = state.mem.data();
+	uint16_t pc = state.pc;
+	bool n = state.n, z = state.z, c = state.c, v = state.v;
+	uint64_t left = max_steps;
+	const sim_ins_t *ins;
+	sim_ins_t ext_ins; // instruction after EXT with extended immediate
+	sim_stop_t stop;
+
+// every instruction which is executed counts as one step
+#define OP(name) do_##name: if (left == 0) { stop = sim_stop_t::limit; goto done; } left--;
+#define NEXT() do { ins = &code[pc]; goto *dispatch[ins->op]; } while (0)
+#define ALU(name, expr) \
+	OP(name##_r) { uint16_t a = r[ins->x], b = r[ins->y]; expr; pc++; NEXT(); } \
+	OP(name##_i) { uint16_t a = r[ins->x], b = ins->imm; expr; pc++; NEXT(); }
+#define JUMP_IF(name, cond) \
+	OP(name) if (cond) { if (ins->imm == 0) goto halt; pc += ins->imm; } else { pc++; } NEXT();
+
+	NEXT();
+
+do_end:
+	stop = sim_stop_t::end;
+	goto done;
+do_invalid:
+	stop = sim_stop_t::invalid;
+	goto done;
+do_unsupported:
+	stop = sim_stop_t::unsupported;
+	goto done;
+
+	ALU(mov, (void)a; r[ins->d] = b)
+	ALU(add, r[ins->d] = add_flags(a, b, 0, n, z, c, v))
+	ALU(sub, r[ins->d] = add_flags(a, ~b, 1, n, z, c, v))
+	ALU(adc, r[ins->d] = add_flags(a, b, c, n, z, c, v))
+	ALU(sbc, r[ins->d] = add_flags(a, ~b, c, n, z, c, v))
+	ALU(and, r[ins->d] = a & b; n = r[ins->d] >> 15; z = r[ins->d] == 0)
+	ALU(cmp, add_flags(a, ~b, 1, n, z, c, v))
+
+#define SHIFT(name, expr) \
+	OP(name) { uint16_t a = r[ins->x]; unsigned cnt = ins->imm & 0xf; r[ins->d] = (expr); \
+		n = r[ins->d] >> 15; z = r[ins->d] == 0; pc++; NEXT(); }
+	SHIFT(lsl, a << cnt)
+	SHIFT(lsr, a >> cnt)
+	SHIFT(asr, static_cast<int16_t>(a) >> cnt)
+	SHIFT(xsr, (a >> cnt) | (a << ((16 - cnt) & 0xf)))
+
+	OP(ldr_r) r[ins->d] = mem[static_cast<uint16_t>(r[ins->x] + ins->imm)]; pc++; NEXT();
+	OP(ldr_d) r[ins->d] = mem[ins->imm]; pc++; NEXT();
+	OP(str_r) mem[static_cast<uint16_t>(r[ins->x] + ins->imm)] = r[ins->d]; pc++; NEXT();
+	OP(str_d) mem[ins->imm] = r[ins->d]; pc++; NEXT();
+
+	JUMP_IF(jmp, true)
+	JUMP_IF(noop, false)
+	JUMP_IF(jeq, z)
+	JUMP_IF(jne, !z)
+	JUMP_IF(jcs, c)
+	JUMP_IF(jcc, !c)
+	JUMP_IF(jmi, n)
+	JUMP_IF(jpl, !n)
+	JUMP_IF(jge, n == v)
+	JUMP_IF(jlt, n != v)
+	JUMP_IF(jgt, n == v && !z)
+	JUMP_IF(jle, n != v || z)
+	JUMP_IF(jhi, c && !z)
+	JUMP_IF(jls, !c || z)
+
+	OP(jsr)
+		if (ins->imm == 0)
+			goto halt;
+		r[7] = pc + 1;
+		pc += ins->imm;
+		NEXT();
+	OP(ret)
+		if (r[7] == pc)
+			goto halt;
+		pc = r[7];
+		NEXT();
+
+	// high byte for the 8 bit immediate of the next instruction
+	OP(ext)
+		ext_ins = code[static_cast<uint16_t>(pc + 1)];
+		if (ext_ins.imm8)
+			ext_ins.imm = (ins->imm << 8) | (ext_ins.imm & 0xff);
+		pc++;
+		ins = &ext_ins;
+		goto *dispatch[ins->op];
+
+#undef OP
+#undef NEXT
+#undef ALU
+#undef JUMP_IF
+#undef SHIFT
+
+halt:
+	stop = sim_stop_t::halt;
+done:
+	state.pc = pc;
+	state.n = n;
+	state.z = z;
+	state.c = c;
+	state.v = v;
+	state.steps += max_steps - left;
+	return stop;
+}
+
+std::string sim_stop_name(sim_stop_t stop) {
+	switch (stop) {
+	case sim_stop_t::halt:
+		return "halted";
+	case sim_stop_t::end:
+		return "end of program";
+	case sim_stop_t::limit:
+		return "step limit reached";
+	case sim_stop_t::invalid:
+		return "invalid instruction";
+	case sim_stop_t::unsupported:
+		return "instruction not supported by the simulator";
+	}
+	return "";
+}
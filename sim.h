@@ -0,0 +1,58 @@
+#ifndef SIM_H
+#define SIM_H
+
+#include <cstdint>
+#include <iosfwd>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "eepasm.h"
+
+constexpr int sim_mem_size = 1 << 16;
+
+// instruction word pre-decoded for the simulator
+struct sim_ins_t {
+	uint8_t op = 0; // sim_op in sim.cpp
+	uint8_t d = 0, x = 0, y = 0; // result register and source registers
+	uint16_t imm = 0; // sign extended immediate, memory offset or jump offset
+	bool imm8 = false; // imm comes from an 8 bit field which EXT extends
+};
+
+// architectural state of one run; code and data memory are separate
+struct sim_state_t {
+	uint16_t reg[8] = {};
+	uint16_t pc = 0;
+	bool n = false, z = false, c = false, v = false;
+	uint64_t steps = 0; // instructions executed
+	std::vector<uint16_t> mem = std::vector<uint16_t>(sim_mem_size);
+
+	void reset();
+};
+
+enum class sim_stop_t {
+	halt, // jump to itself
+	end, // pc left the program
+	limit, // maximum number of steps executed
+	invalid, // word is no encoding of any instruction
+	unsupported, // instruction without simulator semantics
+};
+
+// The program is decoded once with the instruction definitions into one
+// entry per address and then run with threaded dispatch (computed goto)
+// as often as needed.
+class simulator {
+public:
+	simulator(const insmap_t& insmap, const mem_image_t& image);
+
+	sim_stop_t run(sim_state_t& state, uint64_t max_steps) const;
+private:
+	std::vector<sim_ins_t> code;
+};
+
+std::string sim_stop_name(sim_stop_t stop);
+
+#endif
@@ -0,0 +1,60 @@
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <stdexcept>
+#include <cstdint>
+
+#include <sys/resource.h> // for getrusage
+
+#include "eepasm.h"
+
+// the counters of from (not the times) added to to, for the parts of a job
+// counted apart: chunks of parallel lexing and encoding, included files
+void stats_add(asm_stats_t& to, const asm_stats_t& from) {
+	to.lines += from.lines;
+	to.instructions += from.instructions;
+	to.tokens += from.tokens;
+	to.labels += from.labels;
+	to.map_lookups += from.map_lookups;
+	to.hash_probes += from.hash_probes;
+	to.alts_tried += from.alts_tried;
+	to.shorthand += from.shorthand;
+}
+
+long peak_rss_kb() {
+	struct rusage usage;
+	return getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_maxrss : 0;
+}
+
+void stats_print(const asm_stats_t& stats, bool json, std::ostream& out) {
+	double per_ins = stats.instructions ? static_cast<double>(stats.alts_tried) / stats.instructions : 0;
+	double per_line = stats.lines ? static_cast<double>(stats.ir_bytes) / stats.lines : 0;
+	if (json) {
+		out << "{\"phases_s\": {\"config\": " << stats.config << ", \"tokenize\": " << stats.tokenize
+			<< ", \"encode\": " << stats.encode << ", \"output\": " << stats.output
+			<< ", \"total\": " << stats.total << "}, \"lines\": " << stats.lines
+			<< ", \"instructions\": " << stats.instructions << ", \"tokens\": " << stats.tokens
+			<< ", \"labels\": " << stats.labels << ", \"map_lookups\": " << stats.map_lookups
+			<< ", \"hash_probes\": " << stats.hash_probes
+			<< ", \"alts_tried\": " << stats.alts_tried << ", \"alts_per_instruction\": " << per_ins
+			<< ", \"shorthand\": " << stats.shorthand << ", \"bytes_written\": " << stats.bytes_written
+			<< ", \"peak_rss_kb\": " << stats.peak_rss_kb << ", \"ir_bytes\": " << stats.ir_bytes
+			<< ", \"ir_bytes_per_line\": " << per_line << "}\n";
+		return;
+	}
+	out << "phase      seconds\n"
+		<< "config     " << stats.config << "\n"
+		<< "tokenize   " << stats.tokenize << "\n"
+		<< "encode     " << stats.encode << "\n"
+		<< "output     " << stats.output << "\n"
+		<< "total      " << stats.total << "\n"
+		<< "lines " << stats.lines << ", instructions " << stats.instructions << ", tokens " << stats.tokens
+		<< ", labels " << stats.labels << "\n"
+		<< "hash map lookups " << stats.map_lookups << ", perfect hash probes " << stats.hash_probes
+		<< ", alternatives tried " << stats.alts_tried
+		<< " (" << per_ins << " per instruction), 2 operand shorthand " << stats.shorthand << "\n"
+		<< "bytes written " << stats.bytes_written << ", peak RSS " << stats.peak_rss_kb << " KiB\n"
+		<< "token records " << stats.ir_bytes << " bytes (" << per_line << " per line)\n";
+}
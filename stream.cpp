@@ -0,0 +1,157 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <memory> // for shared_ptr
+#include <unordered_map>
+#include <utility> // for pair
+#include <stdexcept>
+#include <cstdint>
+
+#include "eepasm.h"
+#include "module_cache.h"
+
+// Single pass assembly: every line is encoded as soon as it is read.
+// A label operand referring to a label which is not defined yet leaves its
+// field 0 and is recorded as a fixup. Once the label is defined every fixup
+// waiting for it is patched in the write buffer or the already written output
+// file, so memory only grows with the number of labels and unresolved references.
+
+// instruction word waiting for at least one label
+struct pending_word_t {
+	long handle; // out_writer handle for patching
+	int pc;
+	uint16_t iword;
+};
+
+struct fixup_t {
+	std::shared_ptr<pending_word_t> word;
+	const operand_t *opd;
+	std::string where; // line_error prefix of the referencing line, with its included file
+};
+
+void assemble_stream(const insmap_t& insmap, std::istream& infile, const std::string& outfile_name, const asm_opts_t& opts, const std::string& src_path) {
+	out_writer outfile {outfile_name, opts.fmt, opts.out_fd};
+	module_cache_t own_modules; // without a cache shared with other jobs
+	module_refs_t modules {opts.modules ? *opts.modules : own_modules};
+
+	std::deque<std::string> label_names; // owns the keys of labels
+	symtab_t labels;
+	std::unordered_map<std::string, std::vector<fixup_t>, ci_hash, ci_equal> fixups;
+	std::vector<unresolved_t> unresolved;
+
+	auto resolve = [&](std::string_view label, std::vector<fixup_t>& fix_vec) {
+		for (auto& fix : fix_vec) {
+			try {
+				fix.word->iword += label_parse(label, *fix.opd, fix.word->pc, labels);
+				outfile.patch(fix.word->handle, fix.word->pc, fix.word->iword);
+			} catch (const assem_error& err) {
+				throw assem_error {fix.where + err.what()};
+			}
+		}
+	};
+
+	int pc = 0;
+	auto encode = [&](const tokline_t& tokens) {
+		unresolved.clear();
+		uint16_t iword = encode_line(insmap, tokens, pc, labels, &unresolved);
+		long handle;
+		try {
+			handle = outfile.put(pc, iword);
+		} catch (const assem_error& err) {
+			throw source_error {tokens, err.what()};
+		}
+		if (!unresolved.empty()) {
+			auto word = std::make_shared<pending_word_t>(pending_word_t {handle, pc, iword});
+			std::string file = modules.file_of(tokens.text);
+			std::string where = (file.empty() ? "" : file + ": ") + line_error(tokens, "");
+			for (const auto& ref : unresolved)
+				fixups[std::string {ref.label}].push_back({word, ref.opd, where});
+		}
+		pc++;
+	};
+
+	std::string line;
+	int line_no = 0;
+	while (getline(infile, line)) {
+		tokline_t tokens = scan_line(line, ++line_no);
+		if (tokens.ntok == 0)
+			continue;
+
+		std::string_view label = strip_label(tokens, insmap);
+		if (!label.empty()) {
+			try {
+				labels.define(label_names.emplace_back(label), pc, line_no);
+			} catch (const assem_error& err) {
+				throw source_error {line_no, err.what()};
+			}
+			auto fix_it = fixups.find(label);
+			if (fix_it != fixups.end()) {
+				resolve(label, fix_it->second);
+				fixups.erase(fix_it);
+			}
+		}
+		if (tokens.ntok == 0)
+			continue;
+
+		if (is_org(tokens)) {
+			pc = org_parse(tokens);
+			continue;
+		}
+
+		if (is_include(tokens)) {
+			// linked like in tokenize_file, then encoded line by line
+			std::string inc_path = include_path(tokens, src_path);
+			link_state_t ln;
+			ln.labels = std::move(labels);
+			ln.pc = pc;
+			ln.modules = &modules;
+			try {
+				module_link(modules.get(inc_path, insmap), inc_path, false, insmap, ln);
+			} catch (const assem_error& err) {
+				labels = std::move(ln.labels);
+				throw source_error {tokens, err.what()};
+			}
+			labels = std::move(ln.labels);
+			for (auto fix_it = fixups.begin(); fix_it != fixups.end();) {
+				if (labels.value(fix_it->first) < 0) {
+					++fix_it;
+					continue;
+				}
+				resolve(fix_it->first, fix_it->second);
+				fix_it = fixups.erase(fix_it);
+			}
+			try {
+				for (const auto& inc_tokens : ln.out) {
+					if (is_org(inc_tokens))
+						pc = org_parse(inc_tokens);
+					else
+						encode(inc_tokens);
+				}
+			} catch (const source_error& err) {
+				throw modules.locate(err);
+			}
+			continue;
+		}
+
+		encode(tokens);
+	}
+
+	if (!fixups.empty()) {
+		// report the first reference to an undefined label
+		const fixup_t *first = nullptr;
+		std::string label;
+		for (const auto& [name, fix_vec] : fixups) {
+			if (!first || fix_vec[0].word->handle < first->word->handle) {
+				first = &fix_vec[0];
+				label = name;
+			}
+		}
+		throw assem_error {first->where + "label '" + label + "' not found in program"};
+	}
+	outfile.close();
+	if (!opts.sym_file.empty())
+		symtab_save(labels, opts.sym_file, opts.out_fd);
+}
@@ -0,0 +1,73 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <algorithm> // for sort
+#include <stdexcept>
+#include <cstdint>
+#include <unistd.h> // for write
+
+#include "eepasm.h"
+
+int symtab_t::intern(std::string_view name) {
+	auto [it, added] = ids.try_emplace(name, syms.size());
+	if (added)
+		syms.push_back({name});
+	return it->second;
+}
+
+int symtab_t::define(std::string_view name, int value, int line) {
+	int id = intern(name);
+	symbol_t& sym = syms[id];
+	if (sym.value >= 0)
+		throw assem_error {"label '" + std::string {name} + "' already defined on line " + std::to_string(sym.line)};
+	sym = {name, value, line};
+	return id;
+}
+
+int symtab_t::value(std::string_view name) const {
+	auto it = ids.find(name);
+	return it == ids.end() ? -1 : syms[it->second].value;
+}
+
+// defined labels by address, one per line: address (hex as in the ram
+// format), name and line of the definition
+void symtab_write(const symtab_t& labels, std::ostream& out) {
+	std::vector<const symbol_t *> defined;
+	for (const auto& sym : labels.syms)
+		if (sym.value >= 0)
+			defined.push_back(&sym);
+	std::sort(defined.begin(), defined.end(), [](auto a, auto b) {
+		return a->value != b->value ? a->value < b->value : a->line < b->line;
+	});
+
+	char buf[8];
+	for (const symbol_t *sym : defined) {
+		out << "0x";
+		out.write(buf, put_hex(buf, sym->value, 2) - buf);
+		out << ' ' << sym->name << ' ' << sym->line << '\n';
+	}
+}
+
+// symtab_write to path, "-" is stdout_fd
+void symtab_save(const symtab_t& labels, const std::string& path, int stdout_fd) {
+	if (path != "-") {
+		std::ofstream out {path};
+		if (!out.is_open())
+			throw assem_error {"can't open symbol file '" + path + "'"};
+		symtab_write(labels, out);
+		return;
+	}
+	std::ostringstream out;
+	symtab_write(labels, out);
+	std::string text = out.str();
+	for (size_t done = 0; done < text.size();) {
+		ssize_t n = write(stdout_fd, text.data() + done, text.size() - done);
+		if (n < 0)
+			throw assem_error {"can't write symbol table"};
+		done += n;
+	}
+}
@@ -0,0 +1,81 @@
+#include <algorithm> // for max
+
+#include "thread_pool.h"
+
+thread_pool::thread_pool(unsigned nthreads) {
+	if (nthreads == 0)
+		nthreads = std::max(1u, std::thread::hardware_concurrency());
+	for (unsigned i = 0; i < nthreads; i++)
+		queues.push_back(std::make_unique<work_queue>());
+	for (unsigned i = 0; i < nthreads; i++)
+		threads.emplace_back(&thread_pool::worker, this, i);
+}
+
+thread_pool::~thread_pool() {
+	{
+		std::lock_guard<std::mutex> guard {state_lock};
+		stopping = true;
+	}
+	work_cv.notify_all();
+	for (auto& thread : threads)
+		thread.join();
+}
+
+void thread_pool::submit(std::function<void()> job) {
+	work_queue& queue = *queues[next_queue++ % queues.size()];
+	{
+		// counted together with the push, else a worker may pop and count
+		// the job done first and the counters wrap
+		std::lock_guard<std::mutex> guard {state_lock};
+		queued++;
+		pending++;
+		std::lock_guard<std::mutex> queue_guard {queue.lock};
+		queue.jobs.push_back(std::move(job));
+	}
+	work_cv.notify_one();
+}
+
+void thread_pool::wait() {
+	std::unique_lock<std::mutex> guard {state_lock};
+	done_cv.wait(guard, [this] { return pending == 0; });
+}
+
+bool thread_pool::pop(unsigned self, std::function<void()>& job) {
+	for (unsigned i = 0; i < queues.size(); i++) {
+		work_queue& queue = *queues[(self + i) % queues.size()];
+		std::lock_guard<std::mutex> guard {queue.lock};
+		if (queue.jobs.empty())
+			continue;
+		if (i == 0) {
+			job = std::move(queue.jobs.back());
+			queue.jobs.pop_back();
+		} else {
+			job = std::move(queue.jobs.front());
+			queue.jobs.pop_front();
+		}
+		return true;
+	}
+	return false;
+}
+
+void thread_pool::worker(unsigned self) {
+	std::function<void()> job;
+	while (true) {
+		if (pop(self, job)) {
+			{
+				std::lock_guard<std::mutex> guard {state_lock};
+				queued--;
+			}
+			job();
+			job = nullptr;
+			std::lock_guard<std::mutex> guard {state_lock};
+			if (--pending == 0)
+				done_cv.notify_all();
+			continue;
+		}
+		std::unique_lock<std::mutex> guard {state_lock};
+		work_cv.wait(guard, [this] { return stopping || queued > 0; });
+		if (stopping && queued == 0)
+			return;
+	}
+}
@@ -0,0 +1,48 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing thread pool: every worker has its own job queue. Jobs are
+// handed out round robin, a worker takes jobs from the back of its own queue
+// and steals from the front of the other queues once its own runs dry.
+class thread_pool {
+public:
+	explicit thread_pool(unsigned nthreads = 0); // 0: one thread per core
+	~thread_pool();
+	thread_pool(const thread_pool&) = delete;
+	thread_pool& operator=(const thread_pool&) = delete;
+
+	void submit(std::function<void()> job);
+	void wait(); // block until every submitted job has finished
+	unsigned size() const { return threads.size(); }
+
+private:
+	struct work_queue {
+		std::mutex lock;
+		std::deque<std::function<void()>> jobs;
+	};
+
+	bool pop(unsigned self, std::function<void()>& job);
+	void worker(unsigned self);
+
+	std::vector<std::unique_ptr<work_queue>> queues;
+	std::vector<std::thread> threads;
+	std::atomic<unsigned> next_queue {0};
+
+	std::mutex state_lock;
+	std::condition_variable work_cv;
+	std::condition_variable done_cv;
+	size_t queued = 0; // jobs in any queue
+	size_t pending = 0; // jobs submitted but not finished
+	bool stopping = false;
+};
+
+#endif